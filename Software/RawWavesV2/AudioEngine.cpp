@@ -11,65 +11,87 @@
 
 void AudioEngine::init(Settings& config) {
 
-	AudioMemory(25);
+	// Stereo needs a second block from each player, fade and the right mixer
+	AudioMemory(16 + 12 * MAX_VOICES);
 
 	settings = &config;
 
-	playRaw1.loopPlayback(settings->looping);
-	playRaw2.loopPlayback(settings->looping);
+	voiceCount = settings->voices;
+	if (voiceCount < 1) voiceCount = 1;
+	if (voiceCount > MAX_VOICES) voiceCount = MAX_VOICES;
 
-	mixer.gain(0, 1.0);
-	mixer.gain(1, 1.0);
+	headCache.residentLimit = (uint32_t) settings->ramFileKB * 1024;
+
+	// Read with DMA, so loop() can get on while sectors come in
+	boolean dma = settings->dmaReads && sdDevice.begin();
+	if (dma) {
+		sdReader.begin(&sdDevice);
+		headCache.reader = &sdReader;
+	}
+
+	for (uint8_t i = 0; i < MAX_VOICES; i++) {
+		SDPlayPCM& player = voices[i].player;
+		player.loopPlayback(settings->looping);
+		player.setInterpolation(settings->interpolation);
+		player.setStereoMode(settings->stereoMode);
+		player.setCache(&headCache);
+		player.setReader(dma ? &sdReader : NULL);
+		mixer.gain(i, 1.0);
+		mixerRight.gain(i, 1.0);
+	}
 
 	error = false;
 }
 
 D(
 void AudioEngine::test(AudioFileInfo& info1, AudioFileInfo& info2) {
-	currentPlayer->playFrom(&info1);
-	previousPlayer->playFrom(&info2);
+	voices[0].player.playFrom(&info1);
+	voices[1].player.playFrom(&info2);
 }
 
 void AudioEngine::testSwap() {
-	pFadeOut->fadeOut(500);
-	pFadeIn->fadeIn(500);
-	prevAudioElapsed = 0;
-	if(pFadeOut == &fade1) {
-		pFadeOut = &fade2;
-		pFadeIn = &fade1;
-	} else {
-		pFadeOut = &fade1;
-		pFadeIn = &fade2;
-	}
+	Voice* next = current == &voices[0] ? &voices[1] : &voices[0];
+	release(*current, 500);
+	next->fade.fadeIn(500);
+	next->fadeRight.fadeIn(500);
+	next->releasing = false;
+	current = next;
 }
 );
 
-void AudioEngine::swap() {
-	// Swap players and fades.
-	if (currentPlayer == &playRaw1) {
-		currentPlayer = &playRaw2;
-		previousPlayer = &playRaw1;
-		pFadeOut = &fade1;
-		pFadeIn = &fade2;
-		D(
-		Serial.println("AE: Playing through player 2");
-		);
-	} else {
-		currentPlayer = &playRaw1;
-		previousPlayer = &playRaw2;
-		pFadeOut = &fade2;
-		pFadeIn = &fade1;
-		D(
-		Serial.println("AE: Playing through player 1");
-		);
-	}
+// Cache the start of each file in the bank, so changing channel doesn't wait for the card.
+void AudioEngine::setBank(AudioFileInfo* files, uint16_t count) {
+	headCache.setBank(files, count, settings->looping && settings->loopMode == LOOP_MODE_RADIO);
 }
 
 boolean AudioEngine::update() {
 
-	if (currentPlayer->hasFinished()) {
+	// Keep the clock going even if nothing asks for it for a long time
+	radioClock();
+
+	sdReader.poll();
+	// Keep every voice's buffer topped up from the SD card.
+	for (uint8_t i = 0; i < voiceCount; i++) {
+		voices[i].player.prefetch();
+	}
+	// Then fill the cache a bit while they're full
+	headCache.update(radioClock());
+
+	// Stop voices that have faded out
+	for (uint8_t i = 0; i < voiceCount; i++) {
+		Voice& voice = voices[i];
+		if (voice.releasing && voice.released > voice.releaseMs) {
+			D(Serial.print("AE: Stop voice ");Serial.println(i););
+			voice.player.stop();
+			voice.releasing = false;
+			voice.stolen = false;
+		}
+	}
+
+	SDPlayPCM& player = current->player;
+	if (player.hasFinished()) {
 		if(settings->looping) {
-			currentPlayer->restart();
+			player.restart();
 			return false;
 		} else {
 			// Flag EOF
@@ -77,18 +99,11 @@ boolean AudioEngine::update() {
 		}
 	}
 
-	// Check if previously playing rawPlayer has reached fadeOut period and can be stopped.
-	// Or if MUTE is not active.
-	if ((prevAudioElapsed > settings->crossfadeTime || !settings->crossfade) && previousPlayer->isPlaying()) {
-		D(Serial.println("AE: Pause previous player"););
-		previousPlayer->stop();
-	}
-
-	if(currentPlayer->errors > MAX_ERRORS) {
+	if(player.errors > MAX_ERRORS) {
 		D(Serial.println("Player reached max errors."););
 		error = true;
-	} else if(currentPlayer->errors > 0) {
-		D(Serial.print("Error count ");Serial.println(currentPlayer->errors););
+	} else if(player.errors > 0) {
+		D(Serial.print("Error count ");Serial.println(player.errors););
 	}
 	return false;
 }
@@ -97,27 +112,33 @@ void AudioEngine::changeTo(AudioFileInfo* fileInfo, unsigned long start) {
 
 	D(
 		Serial.print("AE: current file is now ");
-		Serial.println(fileInfo->name);
+		Serial.println(fileInfo->getName());
 		Serial.print("AE: Current player has ");
-		Serial.print(currentPlayer->rawfile.name());
+		Serial.print(current->player.rawfile.name());
 		Serial.println();
 	);
 
 	uint32_t pos = 0;
+	uint32_t frameBytes = fileInfo->getBytesPerFrame();
 
-	if (settings->looping && currentFileInfo != NULL) {
+	headCache.setChannel(fileInfo);
+
+	if (settings->looping && settings->loopMode == LOOP_MODE_RADIO) {
+		// Every station has been playing since power on
+		pos = radioFrame(fileInfo) * frameBytes;
+	} else if (settings->looping && currentFileInfo != NULL) {
 		D(
 			Serial.print("Elapsed ");
 			Serial.println(elapsed);
 		);
-		if(settings->loopMode == LOOP_MODE_RADIO) {
-			currentFileInfo->startPlayFrom += ((elapsed * currentFileInfo->getSampleRate() * 2) / 1000);
-			if(currentFileInfo->startPlayFrom % currentFileInfo->getBytesPerSample() != 0) {
-				currentFileInfo->startPlayFrom -= currentFileInfo->startPlayFrom % currentFileInfo->getBytesPerSample();
-			}
-			pos = (fileInfo->startPlayFrom + ((elapsed * fileInfo->getSampleRate()) / 1000));
-		} else if(settings->loopMode == LOOP_MODE_CONTINUE) {
-			pos = currentPlayer->offset() * fileInfo->size;
+		// Where the current player has got to in its file, 32.32 frames
+		uint64_t playing = current->player.position();
+		if(settings->loopMode == LOOP_MODE_CONTINUE && currentFileInfo->getFrames() > 0) {
+			// Same fraction of the way through the new file as the old one.
+			// An empty old file has no fraction, so the new one starts at 0.
+			uint64_t frames = fileInfo->getFrames();
+			uint64_t frame = (playing >> 32) * frames + (((playing & 0xFFFFFFFF) * frames) >> 32);
+			pos = (frame / currentFileInfo->getFrames()) * frameBytes;
 		} else if(settings->loopMode == LOOP_MODE_START_POINT) {
 			pos = (start * fileInfo->size) >> 13;
 		}
@@ -127,11 +148,11 @@ void AudioEngine::changeTo(AudioFileInfo* fileInfo, unsigned long start) {
 		pos = (start * fileInfo->size) >> 13;
 	}
 
-	if(pos % fileInfo->getBytesPerSample() != 0) {
-		pos -= pos % fileInfo->getBytesPerSample();
+	if(pos % frameBytes != 0) {
+		pos -= pos % frameBytes;
 	}
 
-	fileInfo->startPlayFrom = pos % fileInfo->size;
+	fileInfo->startPlayFrom = fileInfo->size > 0 ? pos % fileInfo->size : 0;
 
 	D(
 		Serial.print("AE: start play from ");
@@ -143,56 +164,187 @@ void AudioEngine::changeTo(AudioFileInfo* fileInfo, unsigned long start) {
 
 	// Re-apply speed limits
 	if(settings->pitchMode) {
-		setPlaybackSpeed(currentPlayer->playbackSpeed);
+		setPlaybackSpeed(current->player.playbackSpeed);
 	}
 
 	if(settings->hardSwap) {
-		// If we allow all audio file types then no crossfades, just hard
-		// cut from one to the next
-		AudioNoInterrupts();
-		currentPlayer->playFrom(currentFileInfo);   // change audio
-		previousPlayer->stop();
-		AudioInterrupts();
-	} else {
-
-		swap();
-
+		// No crossfades, just hard cut from one to the next on the same voice.
+		// The others stop first so the ring pool is free for it.
+		for (uint8_t i = 0; i < voiceCount; i++) {
+			voices[i].player.waitIdle();
+		}
 		AudioNoInterrupts();
-		currentPlayer->playFrom(currentFileInfo);   // change audio
-
-		if (settings->crossfade) {
-			// Do a crossfade.
-			D(Serial.print("Crossfade ");Serial.println(settings->crossfadeTime););
-			pFadeOut->fadeOut(settings->crossfadeTime);
-			pFadeIn->fadeIn(settings->crossfadeTime);
-			// And reset the fade timer to let the previous file fade out before pausing it.
-			prevAudioElapsed = 0;
-		} else {
-			D(Serial.println("1ms xfade."););
-			// Emulate no crossfade with 1ms fadeout/in
-			pFadeOut->fadeOut(2);
-			pFadeIn->fadeIn(2);
-			prevAudioElapsed = 0;
+		for (uint8_t i = 0; i < voiceCount; i++) {
+			if (&voices[i] != current) {
+				voices[i].player.stop();
+				voices[i].releasing = false;
+			}
 		}
+		current->player.playFrom(currentFileInfo);   // change audio
 		AudioInterrupts();
+		current->player.prefetch();
+	} else {
+		startVoice(currentFileInfo);
 	}
 
 	D(
 		Serial.print("AE: Current file ");
-		Serial.print(currentPlayer->rawfile.name());
-		Serial.print(" .Prev file ");
-		Serial.print(previousPlayer->rawfile.name());
-		Serial.println();
+		Serial.print(current->player.rawfile.name());
+		Serial.print(" on voice ");
+		Serial.println(current->player.playerID);
 	);
 
 }
 
+// Play info on a voice of its own, from info->startPlayFrom, while the one
+// that was playing fades out.
+void AudioEngine::startVoice(AudioFileInfo* info) {
+	uint16_t attack = settings->crossfade ? settings->crossfadeTime : DECLICK_MS;
+	uint16_t decay = settings->releaseTime > 0 ? settings->releaseTime : attack;
+	D(Serial.print("AE: Fade in ");Serial.print(attack);Serial.print(" out ");Serial.println(decay););
+
+	Voice* previous = current;
+	Voice* voice = allocateVoice(info);
+	// Before the other voices are held up
+	voice->player.waitIdle();
+
+	AudioNoInterrupts();
+	boolean started = voice->player.playFrom(info);   // change audio
+	if (started) {
+		voice->started = ++voiceStarts;
+		voice->releasing = false;
+		voice->stolen = false;
+		voice->fade.fadeIn(attack);
+		voice->fadeRight.fadeIn(attack);
+		if (previous != voice && previous->player.isPlaying() && !previous->releasing) {
+			release(*previous, decay);
+		}
+	}
+	AudioInterrupts();
+
+	if (!started) {
+		// Stopping voices won't help a file that can't be played any other way
+		if (!voice->player.ringPoolFull()) {
+			D(Serial.print("AE: Can't play ");Serial.println(info->getName()););
+			return;
+		}
+		// The other voices' rings leave no gap big enough for this file. Stop the
+		// oldest to make room and try again. It's cut, as a fade would need its ring.
+		Voice* oldest = oldestVoice(voice);
+		if (oldest == NULL) return;
+		D(Serial.print("AE: No ring room, stop voice ");Serial.println(oldest->player.playerID););
+		oldest->player.stop();
+		oldest->releasing = false;
+		oldest->player.waitIdle();
+		startVoice(info);
+		return;
+	}
+
+	current = voice;
+	voice->player.prefetch();
+}
+
+// A voice for info. One that isn't playing if there is one, otherwise the oldest.
+// Then fade out more, oldest first, until everything still playing fits the budgets.
+AudioEngine::Voice* AudioEngine::allocateVoice(AudioFileInfo* info) {
+	Voice* voice = NULL;
+	for (uint8_t i = 0; i < voiceCount && voice == NULL; i++) {
+		if (!voices[i].player.isPlaying()) voice = &voices[i];
+	}
+	if (voice == NULL) voice = oldestVoice(NULL);
+
+	// Voices already stolen keep their share until they've faded out
+	uint32_t sd = sdCost(info);
+	uint32_t decode = decodeCost(info);
+	for (uint8_t i = 0; i < voiceCount; i++) {
+		Voice& other = voices[i];
+		if (&other == voice || !other.player.isPlaying()) continue;
+		sd += sdCost(other.player.playingFile());
+		decode += decodeCost(other.player.playingFile());
+	}
+	// Fade the stolen ones out rather than cut them, which clicks. The few milliseconds
+	// they overlap the new voice come out of what the rings have read ahead.
+	while (sd > VOICE_SD_BUDGET || decode > VOICE_DECODE_BUDGET) {
+		Voice* oldest = oldestVoice(voice, false);
+		if (oldest == NULL) break;
+		D(Serial.print("AE: Over budget, fade out voice ");Serial.println(oldest->player.playerID););
+		sd -= sdCost(oldest->player.playingFile());
+		decode -= decodeCost(oldest->player.playingFile());
+		// One already fading out only has it shortened
+		if (!oldest->releasing || oldest->released + DECLICK_MS < oldest->releaseMs) {
+			release(*oldest, DECLICK_MS);
+		}
+		oldest->stolen = true;
+	}
+	return voice;
+}
+
+// The playing voice to steal first. One that's fading out, otherwise the one that started first.
+// Voices already stolen for the budget are left out unless stolen is set.
+AudioEngine::Voice* AudioEngine::oldestVoice(Voice* except, boolean stolen) {
+	Voice* oldest = NULL;
+	for (uint8_t i = 0; i < voiceCount; i++) {
+		Voice* voice = &voices[i];
+		if (voice == except || !voice->player.isPlaying() || (voice->stolen && !stolen)) continue;
+		if (oldest == NULL || (voice->releasing && !oldest->releasing)
+				|| (voice->releasing == oldest->releasing && voice->started < oldest->started)) {
+			oldest = voice;
+		}
+	}
+	return oldest;
+}
+
+void AudioEngine::release(Voice& voice, uint16_t milliseconds) {
+	voice.fade.fadeOut(milliseconds);
+	voice.fadeRight.fadeOut(milliseconds);
+	voice.releasing = true;
+	voice.released = 0;
+	voice.releaseMs = milliseconds;
+}
+
+boolean AudioEngine::cardIdle() {
+	if (!sdIdle()) return false;
+	for (uint8_t i = 0; i < voiceCount; i++) {
+		SDPlayPCM& player = voices[i].player;
+		if (player.isPlaying() && !headCache.isResident(player.playingFile())) return false;
+	}
+	return true;
+}
+
+// Card bandwidth a file needs at the current speed. Files kept whole in RAM don't need any.
+uint32_t AudioEngine::sdCost(AudioFileInfo* info) {
+	if (info == NULL || headCache.isResident(info)) return 0;
+	return info->getBandwidth() * current->player.playbackSpeed;
+}
+
+// Samples a second the player decodes for a file at the current speed
+uint32_t AudioEngine::decodeCost(AudioFileInfo* info) {
+	if (info == NULL) return 0;
+	return info->getSampleRate() * info->getChannels() * current->player.playbackSpeed;
+}
+
+// Microseconds since the engine started. micros() wraps every 71 minutes,
+// so this has to be called more often than that. update() does.
+uint64_t AudioEngine::radioClock() {
+	uint32_t now = micros();
+	radioMicros += now - radioLastMicros;
+	radioLastMicros = now;
+	return radioMicros;
+}
+
+// The frame a station would be on if it had been playing on a loop since the engine
+// started. It's worked out from the clock when it's needed so the stations that aren't
+// playing need no bookkeeping.
+uint32_t AudioEngine::radioFrame(AudioFileInfo* info) {
+	return info->frameAt(radioClock());
+}
+
 void AudioEngine::setPlaybackSpeed(float speed) {
 	// Limit speed on high bandwidth audio to not overload CPU
 	if(settings->anyAudioFiles && speed > 3.56) {
 		if(speed > 3.56) speed = 3.563595;
-	} else if(speed > 4.489) {
-		speed = 4.4898;
+	} else if(speed > MAX_PLAYBACK_SPEED) {
+		speed = MAX_PLAYBACK_SPEED;
 	}
 	D(
 		Serial.print("AE: Set Playback Speed ");
@@ -202,47 +354,72 @@ void AudioEngine::setPlaybackSpeed(float speed) {
 		Serial.print(" ");
 		Serial.println(currentFileInfo->getSampleRate());
 	);
-	currentPlayer->playbackSpeed = speed;
-	previousPlayer->playbackSpeed = speed;
+	for (uint8_t i = 0; i < MAX_VOICES; i++) {
+		voices[i].player.playbackSpeed = speed;
+	}
 }
 
 void AudioEngine::skipTo(uint32_t pos) {
 	// In the original Radio Music, with Teensy 3.2, pos was expected from 0 -> 8192, since the ADC_BITS was 13
 	// The Teensy 4 has ADC_BITS of 10. Thus we change this to 0 -> 1024
-	uint32_t samplePos = ((float)pos / 1024.0) * (currentFileInfo->size / currentFileInfo->getBytesPerSample());
+	uint32_t frame = ((uint64_t) pos * currentFileInfo->getFrames()) >> 10;
 	D(
 		Serial.print("AE: Skip To ");
-		Serial.println(samplePos);
+		Serial.println(frame);
 	);
-	currentFileInfo->startPlayFrom = (samplePos * currentFileInfo->getBytesPerSample()) % currentFileInfo->size;
-	currentPlayer->skipTo(currentFileInfo->startPlayFrom);
+	currentFileInfo->startPlayFrom = currentFileInfo->size > 0 ? (frame * currentFileInfo->getBytesPerFrame()) % currentFileInfo->size : 0;
+	if (settings->hardSwap) {
+		current->player.skipTo(currentFileInfo->startPlayFrom);
+		current->player.prefetch();
+	} else {
+		// Retrigger on another voice so the one playing can ring out
+		startVoice(currentFileInfo);
+	}
 	elapsed = 0;
 }
 
 void AudioEngine::measure() {
-	Serial.print("AE: Buffer fills ");
-	Serial.print(playRaw1.bufferFills);
-	Serial.print("\t");
-	Serial.print(playRaw2.bufferFills);
-	Serial.print(" .Updates ");
-	Serial.print(playRaw1.updates);
-	Serial.print("\t");
-	Serial.print(playRaw2.updates);
-	Serial.print(" .CPU ");
-	Serial.print(playRaw1.processorUsageMax());
-	Serial.print("\t");
-	Serial.print(playRaw2.processorUsageMax());
-	Serial.print(" . Errors ");
-	Serial.print(playRaw1.errors);
-	Serial.print("\t");
-	Serial.println(playRaw2.errors);
-
-	playRaw1.bufferFills = 0;
-	playRaw2.bufferFills = 0;
-	playRaw1.updates = 0;
-	playRaw2.updates = 0;
-	playRaw1.processorUsageMaxReset();
-	playRaw2.processorUsageMaxReset();
+	for (uint8_t i = 0; i < voiceCount; i++) {
+		SDPlayPCM& player = voices[i].player;
+		Serial.print("AE: Voice ");
+		Serial.print(i + 1);
+		Serial.print(current == &voices[i] ? "*" : " ");
+		Serial.print(" Buffer fills ");
+		Serial.print(player.bufferFills);
+		Serial.print(" .Updates ");
+		Serial.print(player.updates);
+		Serial.print(" .CPU ");
+		Serial.print(player.processorUsageMax());
+		Serial.print(" . Errors ");
+		Serial.print(player.errors);
+		Serial.print(" . Underruns ");
+		Serial.print(player.underruns);
+		Serial.print(" . Decode cycles ");
+		Serial.print(player.decodeCyclesMax);
+		Serial.print(" . Start us ");
+		Serial.println(player.startLatencyMax);
+
+		player.bufferFills = 0;
+		player.updates = 0;
+		player.processorUsageMaxReset();
+		player.decodeCyclesMax = 0;
+		player.startLatencyMax = 0;
+	}
+	Serial.print("AE: Cache hits ");
+	Serial.print(headCache.hits);
+	Serial.print("/");
+	Serial.print(headCache.hits + headCache.misses);
+	Serial.print(" of ");
+	Serial.print(headCache.headMs);
+	Serial.print("ms, ");
+	Serial.print(headCache.residentCount);
+	Serial.print(" whole");
+	// Decode cost depends on the file's rate, so say what's playing
+	Serial.print(" . Rate ");
+	Serial.println(currentFileInfo != NULL ? currentFileInfo->getSampleRate() : 0);
+
+	headCache.hits = 0;
+	headCache.misses = 0;
 }
 
 float AudioEngine::getPeak() {
@@ -4,64 +4,91 @@
 #include <Audio.h>
 
 #include "SDPlayPCM.h"
+#include "HeadCache.h"
 #include "Settings.h"
 
 #define MAX_ERRORS 10
 
+// Each voice has an input on mixer and mixerRight
+#if MAX_VOICES > 4
+#error "MAX_VOICES can't be more than the 4 inputs of an AudioMixer4"
+#endif
+
+// What all the voices playing at once can ask for. The oldest are faded out to stay inside it.
+// Card bandwidth in bytes per second. Two full bandwidth files, what the old pair of players needed.
+#define VOICE_SD_BUDGET (MAX_BANDWIDTH * 2)
+// Samples decoded per second. Two 44.1k stereo files at the fastest playback speed.
+#define VOICE_DECODE_BUDGET (44100 * 2 * 2 * MAX_PLAYBACK_SPEED)
+// Fade in and out when crossfades are off. Just enough to stop clicks.
+#define DECLICK_MS 2
+
 class AudioEngine {
 	public:
 		void test(AudioFileInfo& info1, AudioFileInfo& info2);
 		void testSwap();
 
-		SDPlayPCM *currentPlayer;
-		SDPlayPCM *previousPlayer;
-		AudioEffectFade *pFadeOut;
-		AudioEffectFade *pFadeIn;
+		// Each voice is a player with a fade for each channel, its envelope, on its own
+		// input of each mixer.
+		struct Voice {
+			SDPlayPCM player;
+			AudioEffectFade fade;
+			AudioEffectFade fadeRight;
+			// Counts up as voices start, so the oldest can be stolen first
+			uint32_t started = 0;
+			// Fading out. Stopped once releaseMs has gone by.
+			boolean releasing = false;
+			elapsedMillis released;
+			uint16_t releaseMs = 0;
+			// Fading out to make room in the budgets
+			boolean stolen = false;
+		};
 
 		// Audio engine definitions.
-		SDPlayPCM playRaw1;
-		SDPlayPCM playRaw2;
-		AudioEffectFade fade1;
-		AudioEffectFade fade2;
+		Voice voices[MAX_VOICES];
+		Voice* current;
 		AudioMixer4 mixer;
+		AudioMixer4 mixerRight;
 		AudioAnalyzePeak peak1;
 	    AudioOutputPT8211 dac1;
+		// Four for each voice. Player to fades, fades to mixers.
+		AudioConnection voiceCords[MAX_VOICES * 4];
 		AudioConnection patchCord1;
 		AudioConnection patchCord2;
 		AudioConnection patchCord3;
-		AudioConnection patchCord4;
-		AudioConnection patchCord5;
-		AudioConnection patchCord6;
 
-		elapsedMillis prevAudioElapsed;
 		boolean eof = false;
 
 		AudioEngine() : // Constructor definition for AudioEngine class
-			patchCord1(playRaw1, fade1), 
-			patchCord2(playRaw2, fade2),
-			patchCord3(fade1, 0, mixer, 0),
-			patchCord4(fade2, 0, mixer, 1),
-			patchCord5(mixer, 0, dac1, 0),
-			patchCord6(mixer, 0, peak1, 0){
+			patchCord1(mixer, 0, dac1, 0),
+			patchCord2(mixer, 0, peak1, 0),
+			patchCord3(mixerRight, 0, dac1, 1){
 				// Constructor body for AudioEngine class
-
-				playRaw1.playerID = 1;
-				playRaw2.playerID = 2;
-				currentPlayer = &playRaw1;
-
-				previousPlayer = &playRaw2;
-				pFadeOut = &fade1;
-				pFadeIn = &fade2;
+				for (uint8_t i = 0; i < MAX_VOICES; i++) {
+					Voice& voice = voices[i];
+					voice.player.playerID = i + 1;
+					// The players send mono on both outputs
+					voiceCords[i * 4].connect(voice.player, 0, voice.fade, 0);
+					voiceCords[i * 4 + 1].connect(voice.player, 1, voice.fadeRight, 0);
+					voiceCords[i * 4 + 2].connect(voice.fade, 0, mixer, i);
+					voiceCords[i * 4 + 3].connect(voice.fadeRight, 0, mixerRight, i);
+				}
+				current = &voices[0];
 			}
 
 		void init(Settings& settings);
 		boolean update();
-		void swap();
+		void setBank(AudioFileInfo* files, uint16_t count);
 		void changeTo(AudioFileInfo* audioFileInfo, unsigned long start);
 		void skipTo(uint32_t time);
 		void setPlaybackSpeed(float speed);
+		uint64_t radioClock();
+		uint32_t radioFrame(AudioFileInfo* info);
 		void measure();
 		float getPeak();
+		// No reads in flight, so something else can use the SD library
+		boolean sdIdle() { return sdReader.idle(); }
+		// Nothing is streaming from the card either, so a write to it can't hold a voice up
+		boolean cardIdle();
 		AudioFileInfo* currentFileInfo;
 		boolean error = false;
 
@@ -73,6 +100,24 @@ class AudioEngine {
 		boolean updateRequired = false;
 		AudioFileInfo* nextInfo;
 		Settings* settings;
+		HeadCache headCache;
+		SPISectorDevice sdDevice;
+		SDReader sdReader;
+
+		// Voices in use, up to MAX_VOICES
+		uint8_t voiceCount = MAX_VOICES;
+		uint32_t voiceStarts = 0;
+
+		void startVoice(AudioFileInfo* info);
+		Voice* allocateVoice(AudioFileInfo* info);
+		Voice* oldestVoice(Voice* except, boolean stolen = true);
+		void release(Voice& voice, uint16_t milliseconds);
+		uint32_t sdCost(AudioFileInfo* info);
+		uint32_t decodeCost(AudioFileInfo* info);
+
+		// Radio mode clock. See radioClock()
+		uint64_t radioMicros = 0;
+		uint32_t radioLastMicros = 0;
 
 //		boolean hardSwap = false;
 //		boolean looping = false;
@@ -2,6 +2,7 @@
 #define AudioFileInfo_h
 
 #include <Arduino.h>
+#include "NamePool.h"
 
 #define CHANNELS_MASK B00000001
 #define MONO 		  0
@@ -13,26 +14,24 @@
 #define BIT_DEPTH_24 	2 // 10
 #define BIT_DEPTH_32 	3 // 11
 
-#define SAMPLE_RATE_MASK 	B00111000
-#define SAMPLE_RATE_11		0 // 000
-#define SAMPLE_RATE_22  	1 // 001
-#define SAMPLE_RATE_44  	2 // 010
-#define SAMPLE_RATE_48  	3 // 011
-#define SAMPLE_RATE_96  	4 // 100
+// Sample rates the players can resample from
+#define MIN_SAMPLE_RATE 	4000
+#define MAX_SAMPLE_RATE 	96000
+
+// IEEE float samples. Only with BIT_DEPTH_32
+#define SAMPLE_FLOAT		B01000000
 
-static uint32_t SAMPLE_RATES[5] = { 11025,22050,44100,48000,96000 };
 static uint8_t BIT_DEPTHS[4] = {8,16,24,32};
 
 class AudioFileInfo {
 public:
 
-	String name;
 	// Size doesn't include the header for wav files, just the length of the audio
 	uint32_t size;
 
-//	// Only accept 11025, 22050, 44100, 88,200, 48000 and 96000
-//	uint32_t sampleRate;
-//
+	// Exact sample rate in Hz
+	uint32_t sampleRate = 44100;
+
 //	// Only allow mono or stereo
 //	uint16_t channels;
 //
@@ -48,6 +47,14 @@ public:
 	// Store where playback ended if we want to resume
 	uint32_t startPlayFrom = 0;
 
+	// Where the file starts on the card, if it's all in one run of sectors.
+	// Then any position can be read without following the FAT. 0 if it isn't.
+	uint32_t firstSector = 0;
+
+	const char* getName() {
+		return fileNames.get(nameOffset);
+	}
+
 	void setChannels(uint8_t channels) {
 		if(channels == 2) {
 			format |= 1;
@@ -59,26 +66,16 @@ public:
 	}
 
 	// Return false is sample rate not supported
-	boolean setSampleRate(uint32_t sampleRate) {
-		if(sampleRate % 11025 == 0) {
-			uint8_t m = (sampleRate / 11025) - 1;
-
-			if(m == 3) m = 2;
-			format |= m << 3;
-		} else if(sampleRate % 48000 == 0) {
-			if(sampleRate / 48000 == 1) {
-				format |= 3 << 3;
-			} else {
-				format |= 4 << 3;
-			}
-		} else {
+	boolean setSampleRate(uint32_t rate) {
+		if(rate < MIN_SAMPLE_RATE || rate > MAX_SAMPLE_RATE) {
 			return false;
 		}
+		sampleRate = rate;
 		return true;
 	}
 
 	uint32_t getSampleRate() {
-		return SAMPLE_RATES[(format & SAMPLE_RATE_MASK) >> 3];
+		return sampleRate;
 	}
 
 	void setBitsPerSample(uint8_t bits) {
@@ -89,6 +86,32 @@ public:
 		return BIT_DEPTHS[(format & BIT_DEPTH_MASK) >> 1] >> 3;
 	}
 
+	uint8_t getBytesPerFrame() {
+		return getBytesPerSample() * getChannels();
+	}
+
+	// Length of the audio in frames
+	uint32_t getFrames() {
+		return size / getBytesPerFrame();
+	}
+
+	// The frame reached after playing on a loop for this many microseconds
+	uint32_t frameAt(uint64_t micros) {
+		uint32_t frames = getFrames();
+		if (frames == 0) return 0;
+		// Whole seconds and the rest separately so it can't overflow
+		uint64_t frame = (micros / 1000000) * sampleRate + ((micros % 1000000) * sampleRate) / 1000000;
+		return frame % frames;
+	}
+
+	void setFloat() {
+		format |= SAMPLE_FLOAT;
+	}
+
+	boolean isFloat() {
+		return format & SAMPLE_FLOAT;
+	}
+
 	// Bytes per second
 	uint32_t getBandwidth() {
 		return getSampleRate() * getBytesPerSample() * getChannels();
@@ -101,13 +124,14 @@ public:
 	// 0 1 : 16 bit
 	// 1 0 : 24 bit
 	// 1 1 : 32 bit
-	// Bits 2 -> 5 : Sample Rate. 11, 22, 44, 48 and 96
-	// 0 0 1 : 11
-	// 0 1 0 : 22
-	// 0 1 1 : 44
-	// 1 0 0 : 48
-	// 1 0 1 : 96
+	// Bits 3 -> 5 : Unused. Sample rate is stored in sampleRate
+	// Bit 6 : IEEE float
 	uint8_t format = 0;
+
+	// Bank the file's in, to group the table by
+	uint8_t bank = 0;
+	// Where the path is in fileNames. Next to format and bank so the whole thing is 24 bytes.
+	uint16_t nameOffset = 0;
 };
 
 #endif
@@ -9,35 +9,187 @@
 #define D(x)
 #endif
 
-// File name compare routine for qsort
-int fileNameCompare(const void *a, const void *b) {
-	AudioFileInfo *sa = (AudioFileInfo *) a;
-	AudioFileInfo *sb = (AudioFileInfo *) b;
+// Set for the compare routines while a sort's running
+static uint8_t sortMode = SORT_NAME;
+static AudioFileInfo* sortTable = NULL;
 
-	return sa->name.compareTo(sb->name);
+static inline boolean isNumeral(char c) {
+	return c >= '0' && c <= '9';
+}
+
+// The path without its bank directory. Banks are sorted on their own so it's left out.
+static const char* nameInBank(const char* path) {
+	const char* slash = strchr(path, '/');
+	return slash == NULL ? path : slash + 1;
+}
+
+// Like strcmp, but runs of digits are compared by their value, so 2 comes before 10.
+int naturalCompare(const char* a, const char* b) {
+	while (*a != 0 && *b != 0) {
+		if (isNumeral(*a) && isNumeral(*b)) {
+			while (*a == '0') a++;
+			while (*b == '0') b++;
+			uint8_t lengthA = 0;
+			uint8_t lengthB = 0;
+			while (isNumeral(a[lengthA])) lengthA++;
+			while (isNumeral(b[lengthB])) lengthB++;
+			if (lengthA != lengthB) return lengthA - lengthB;
+			int difference = memcmp(a, b, lengthA);
+			if (difference != 0) return difference;
+			a += lengthA;
+			b += lengthB;
+		} else {
+			if (*a != *b) return (uint8_t) *a - (uint8_t) *b;
+			a++;
+			b++;
+		}
+	}
+	return (uint8_t) *a - (uint8_t) *b;
+}
+
+// File compare routine, by bank and then name
+int fileCompare(AudioFileInfo* a, AudioFileInfo* b) {
+	if (a->bank != b->bank) return a->bank - b->bank;
+	// Names go in the pool in the order the files were found
+	if (sortMode == SORT_NONE) return a->nameOffset - b->nameOffset;
+	const char* nameA = nameInBank(a->getName());
+	const char* nameB = nameInBank(b->getName());
+	int difference = sortMode == SORT_NATURAL ? naturalCompare(nameA, nameB) : strcmp(nameA, nameB);
+	if (difference != 0) return difference;
+	return strcmp(a->getName(), b->getName());
+}
+
+// For qsort when there's no room for the keys
+int fileInfoCompare(const void *a, const void *b) {
+	return fileCompare((AudioFileInfo*) a, (AudioFileInfo*) b);
+}
+
+int sortEntryCompare(const void *a, const void *b) {
+	FileScanner::SortEntry *sa = (FileScanner::SortEntry *) a;
+	FileScanner::SortEntry *sb = (FileScanner::SortEntry *) b;
+
+	if (sa->key != sb->key) return sa->key < sb->key ? -1 : 1;
+	return fileCompare(&sortTable[sa->index], &sortTable[sb->index]);
 }
 
 FileScanner::FileScanner() {
 }
 
-void FileScanner::sortFiles() {
-	for (int i = 0; i < BANKS; i++) {
-		if (numFilesInBank[i] > 0) {
-			qsort(&(fileInfos[i][0]), numFilesInBank[i], sizeof(AudioFileInfo),
-					fileNameCompare);
+// Orders files the same way fileCompare does, as far as it goes. The bank,
+// then the first characters of the name. A run of digits goes in as '0' and
+// ends the key, except at the start where its value is used.
+uint32_t FileScanner::sortKey(AudioFileInfo& info) {
+	uint32_t key = (uint32_t) info.bank << 28;
+	if (sortMode == SORT_NONE) return key;
+	const uint8_t* name = (const uint8_t*) nameInBank(info.getName());
+	if (sortMode == SORT_NATURAL && isNumeral(name[0])) {
+		uint32_t value = 0;
+		while (isNumeral(*name)) {
+			value = min(value * 10 + (*name - '0'), (uint32_t) 0xFFFFF);
+			name++;
+		}
+		return key | ('0' << 20) | value;
+	}
+	for (uint8_t i = 0; i < 3 && *name != 0; i++) {
+		if (sortMode == SORT_NATURAL && isNumeral(*name)) {
+			return key | ('0' << (20 - i * 8));
 		}
+		key |= (uint32_t) *name << (20 - i * 8);
+		name++;
+	}
+	return key;
+}
+
+// Group the table by bank, sorted by name if wanted. Files from first up.
+// Sorts keys and indexes, then moves each file once.
+void FileScanner::sortFiles(uint16_t first) {
+	uint16_t count = fileCount - first;
+	SortEntry* order = count > 1 ? (SortEntry*) malloc(count * sizeof(SortEntry)) : NULL;
+	if (order != NULL) {
+		for (uint16_t i = 0; i < count; i++) {
+			order[i].key = sortKey(files[first + i]);
+			order[i].index = first + i;
+		}
+		sortTable = files;
+		qsort(order, count, sizeof(SortEntry), sortEntryCompare);
+
+		// Follow each cycle of the permutation round, marking places as they're filled
+		for (uint16_t i = 0; i < count; i++) {
+			if (order[i].index == first + i) continue;
+			AudioFileInfo held = files[first + i];
+			uint16_t to = i;
+			while (true) {
+				uint16_t from = order[to].index - first;
+				order[to].index = first + to;
+				if (from == i) {
+					files[first + to] = held;
+					break;
+				}
+				files[first + to] = files[first + from];
+				to = from;
+			}
+		}
+		free(order);
+	} else if (count > 1) {
+		qsort(&files[first], count, sizeof(AudioFileInfo), fileInfoCompare);
+	}
+	for (uint16_t i = fileCount; i > first; i--) {
+		bankStart[files[i - 1].bank] = i - 1;
 	}
 }
 
 void FileScanner::scan(File* root, Settings& settings) {
+	begin(root, settings, -1);
+	finish();
+}
+
+void FileScanner::begin(File* root, Settings& settings, int firstBank) {
 
 	onlyNativeFormat = !settings.anyAudioFiles;
 
-	if(!onlyNativeFormat) {
-		maximumFilesPerBank = 32;
+	scanTime = 0;
+	// As much as allowed now. It's cut down to what was found once the scan's done.
+	uint32_t capacity = (uint32_t) settings.fileTableKB * 1024 / sizeof(AudioFileInfo);
+	fileCapacity = min(capacity, (uint32_t) 0xFFFF);
+	// Less if the scan indexes wouldn't fit beside it, or every boot reads every header
+	while (fileCapacity > 1 && !roomFor(fileCapacity)) {
+		fileCapacity /= 2;
+	}
+	if (fileCapacity < capacity) {
+		Serial.print("Room for ");
+		Serial.print(fileCapacity);
+		Serial.println(" files. Lower filetablekb or free some RAM2.");
+	}
+	files = (AudioFileInfo*) malloc(max(fileCapacity, (uint16_t) 1) * sizeof(AudioFileInfo));
+	while (files == NULL && fileCapacity > 0) {
+		fileCapacity /= 2;
+		files = (AudioFileInfo*) malloc(max(fileCapacity, (uint16_t) 1) * sizeof(AudioFileInfo));
+	}
+	fileCount = 0;
+	firstCount = 0;
+	firstFiles = NULL;
+	skippedFiles = 0;
+	tableFull = 0;
+	namesFull = 0;
+	scanDone = false;
+	if (files == NULL) {
+		// Every bank is empty
+		Serial.println("No memory for the file table");
+		fileCapacity = 0;
+		scanDone = true;
+		return;
+	}
+	files[0] = AudioFileInfo();
+	D(Serial.print("Room for "); Serial.print(fileCapacity); Serial.println(" files"););
+
+	loadIndex();
+	newIndex = (IndexEntry*) malloc(indexCapacity() * sizeof(IndexEntry));
+	if (newIndex == NULL) {
+		Serial.println("No memory for the scan index. It won't be saved.");
 	}
 
 	if (SD.exists("config.txt")) {
+		// Files are put in banks in the order they're found, so it all has to be scanned now
 		D(Serial.println("Scan TipTop"); );
 		getExtensionlessFilesInRoot(root);
 		// disable looping for now
@@ -47,22 +199,130 @@ void FileScanner::scan(File* root, Settings& settings) {
 		settings.pitchMode = true;
 		D(
 			Serial.print("Finished Tip Top with "); Serial.print(lastBankIndex); Serial.println(" active banks"););
-	} else {
-		D(
-			if(onlyNativeFormat) {
-				Serial.println("Scan Radio Music. 44/16 Only.");
-			} else {
-				Serial.println("Scan Radio Music. All supported formats.");
+		// Already in bank order
+		sortMode = SORT_NONE;
+		finish();
+		return;
+	}
+
+	D(
+		if(onlyNativeFormat) {
+			Serial.println("Scan Radio Music. 44/16 Only.");
+		} else {
+			Serial.println("Scan Radio Music. All supported formats.");
+		}
+
+	);
+	sortMode = !settings.sort ? SORT_NONE : settings.naturalSort ? SORT_NATURAL : SORT_NAME;
+	this->firstBank = -1;
+
+	if (firstBank >= 0 && firstBank < BANKS) {
+		firstDirectory = String(firstBank);
+		File dir = SD.open(firstDirectory.c_str());
+		if (dir && dir.isDirectory()) {
+			FsFile sdDir = SD.sdfs.open(firstDirectory.c_str(), O_RDONLY);
+			openDirectory(dir, sdDir, firstDirectory);
+			while (depth > 0) {
+				scanNext();
 			}
+			// All in this bank, at the start of the table
+			sortFiles(0);
+			firstCount = fileCount;
+			this->firstBank = firstBank;
+			moveFirstBank();
+			D(Serial.print("Bank "); Serial.print(firstBank); Serial.print(" scanned in "); Serial.print(scanTime); Serial.println("ms"););
+		} else if (dir) {
+			dir.close();
+		}
+	}
+	FsFile sdRoot = SD.sdfs.open("/", O_RDONLY);
+	openDirectory(*root, sdRoot, "0");
+}
 
-		);
-		scanDirectory(root);
-		D(Serial.println("Scan finished"); );
-		if (settings.sort) {
-			sortFiles();
-			D(showSortedFiles());
+// Whether a table of capacity files fits in the heap, with the index loaded from
+// the card and the one this scan makes beside it. They're allocated and given back.
+boolean FileScanner::roomFor(uint16_t capacity) {
+	void* table = malloc(capacity * sizeof(AudioFileInfo));
+	void* indexes = table != NULL ? malloc(2 * ((uint32_t) capacity + SCAN_INDEX_EXTRA) * sizeof(IndexEntry)) : NULL;
+	free(indexes);
+	free(table);
+	return indexes != NULL;
+}
+
+// Before anything plays from it. If there's no room for it, it stays where it is
+// and the table isn't cut down.
+void FileScanner::moveFirstBank() {
+	if (firstCount == 0) return;
+	AudioFileInfo* first = (AudioFileInfo*) malloc(firstCount * sizeof(AudioFileInfo));
+	if (first == NULL) {
+		D(Serial.println("No room to move the first bank"););
+		return;
+	}
+	memcpy(first, files, firstCount * sizeof(AudioFileInfo));
+	firstFiles = first;
+	fileCapacity -= firstCount;
+	fileCount = 0;
+	files[0] = AudioFileInfo();
+}
+
+void FileScanner::update(uint32_t micros) {
+	elapsedMicros sliceTime;
+	while (depth > 0 && sliceTime < micros) {
+		scanNext();
+	}
+	if (depth == 0 && !scanDone) {
+		finish();
+	}
+}
+
+void FileScanner::finish() {
+	while (depth > 0) {
+		scanNext();
+	}
+	if (scanDone) return;
+	scanDone = true;
+
+	D(Serial.println("Scan finished"); );
+	// The first bank may be playing, so it's left where it is
+	uint16_t first = firstFiles != NULL ? 0 : firstCount;
+	sortFiles(first);
+	D(showSortedFiles());
+
+	// Written by saveIndex() when it won't hold up the players. There's none
+	// to write if there wasn't room for it.
+	free(index);
+	index = NULL;
+	if (newIndex != NULL && (indexChanged || newIndexCount != indexCount)) {
+		savePending = true;
+		indexSaved = 0;
+	} else {
+		free(newIndex);
+		newIndex = NULL;
+	}
+	// Give back what wasn't needed. realloc() can move the table even to shrink it,
+	// so not if the first bank is still in it.
+	if (fileCount < fileCapacity && first == 0) {
+		AudioFileInfo* smaller = (AudioFileInfo*) realloc(files, max(fileCount, (uint16_t) 1) * sizeof(AudioFileInfo));
+		if (smaller != NULL) {
+			files = smaller;
+			fileCapacity = fileCount;
 		}
 	}
+	if (tableFull > 0) {
+		Serial.print(tableFull);
+		Serial.println(" files skipped. Raise filetablekb for more.");
+	}
+	if (namesFull > 0) {
+		Serial.print(namesFull);
+		Serial.println(" files skipped, there's no more room for names.");
+	}
+	D(
+		Serial.print("Scan took "); Serial.print(scanTime); Serial.print("ms. ");
+		Serial.print(indexHits); Serial.print(" files from the index, ");
+		Serial.print(indexMisses); Serial.println(" read");
+		Serial.print("File tables use "); Serial.print(tableBytes()); Serial.println(" bytes");
+		Serial.print("Names use "); Serial.print(fileNames.used); Serial.print(" of "); Serial.print(NAME_POOL_SIZE); Serial.println(" bytes");
+	);
 }
 
 void FileScanner::showSortedFiles() {
@@ -71,7 +331,7 @@ void FileScanner::showSortedFiles() {
 		Serial.println(i);
 		if (numFilesInBank[i] > 0) {
 			for(int j=0;j<numFilesInBank[i];j++) {
-				Serial.println(fileInfos[i][j].name);
+				Serial.println(bankFiles(i)[j].getName());
 			}
 		}
 	}
@@ -79,6 +339,7 @@ void FileScanner::showSortedFiles() {
 
 void FileScanner::getExtensionlessFilesInRoot(File* root) {
 	int directoryNumber = 0;
+	FsFile sdRoot = SD.sdfs.open("/", O_RDONLY);
 
 	while (true) {
 		File currentFile = root->openNextFile(O_RDONLY);
@@ -89,12 +350,17 @@ void FileScanner::getExtensionlessFilesInRoot(File* root) {
 		}
 		boolean addFile = false;
 		currentFilename = currentFile.name();
+		FsFile entry = nextEntry(sdRoot, currentFilename);
 		if (!currentFile.isDirectory() && currentFilename.indexOf('.') == -1) {
 			// assume its a tip top style wav file
-			int numFiles = numFilesInBank[directoryNumber];
-
-			AudioFileInfo& fileInfo = fileInfos[directoryNumber][numFiles];
-			addFile = processWavFile(&currentFile, fileInfo);
+			char* path = fileNames.start(NULL, currentFilename.c_str());
+			if (path == NULL || fileCount == fileCapacity) {
+				skipFile(path == NULL ? currentFilename.c_str() : path, path == NULL ? &namesFull : &tableFull);
+				currentFile.close();
+				continue;
+			}
+			AudioFileInfo& fileInfo = files[fileCount];
+			addFile = processFile(&currentFile, entry, fileInfo, path, true);
 
 			if (addFile) {
 				fileInfo.dataOffset = 48;
@@ -106,10 +372,12 @@ void FileScanner::getExtensionlessFilesInRoot(File* root) {
 						Serial.println(fileInfo.size % 3);
 					}
 				);
-				fileInfo.name = currentFile.name();
+				fileInfo.nameOffset = fileNames.keep();
+				fileInfo.bank = directoryNumber;
+				fileCount++;
 				numFilesInBank[directoryNumber]++;
 			}
-			if (numFilesInBank[directoryNumber] >= MAX_FILES) {
+			if (numFilesInBank[directoryNumber] >= TIPTOP_FILES_PER_BANK) {
 				directoryNumber++;
 				if (directoryNumber >= BANKS) {
 					D(Serial.println("Max Files reached"); );
@@ -126,79 +394,313 @@ void FileScanner::getExtensionlessFilesInRoot(File* root) {
 
 		currentFile.close();
 	}
+	sdRoot.close();
 }
 
-void FileScanner::scanDirectory(File* dir) {
+void FileScanner::openDirectory(File& dir, FsFile& sdDir, const String& name) {
+	D(Serial.print("Scan Dir "); Serial.println(dir.name()); Serial.println(););
+	directories[depth] = dir;
+	sdDirectories[depth] = sdDir;
+	directoryNames[depth] = name;
+	depth++;
+	currentDirectory = name;
+}
 
-	D(Serial.print("Scan Dir "); Serial.println(dir->name()); Serial.println(););
+void FileScanner::leaveDirectory() {
+	depth--;
+	directories[depth].close();
+	sdDirectories[depth].close();
+	if (depth > 0) {
+		currentDirectory = directoryNames[depth - 1];
+	}
+}
 
-	while (true) {
+// One entry of the innermost directory
+void FileScanner::scanNext() {
 
-		File currentFile = dir->openNextFile(FILE_READ);
-		if (!currentFile) {
-			D(Serial.print("No file from "); Serial.print(dir->name()); Serial.print("\t"); Serial.println(currentFile.name()););
-			break;
-		} else {
-			D(Serial.print("Current file is ");Serial.println(currentFile.name()));
-		}
-		currentFilename = currentFile.name();
-		boolean addFile = false;
+	File currentFile = directories[depth - 1].openNextFile(FILE_READ);
+	if (!currentFile) {
+		D(Serial.print("No file from "); Serial.println(directories[depth - 1].name()););
+		leaveDirectory();
+		return;
+	} else {
+		D(Serial.print("Current file is ");Serial.println(currentFile.name()));
+	}
+	currentFilename = currentFile.name();
+	boolean addFile = false;
+	FsFile entry = nextEntry(sdDirectories[depth - 1], currentFilename);
+
+	if (currentFilename.startsWith("_") != 0) {
+		currentFile.close();
+		return;
+	}
 
-		if (currentFilename.startsWith("_") != 0) {
-			currentFile.close();
-			continue;
+	if (currentFile.isDirectory()) {
+		// Ignore OSX Spotlight and Trash Directories, and the first bank which is already done
+		if (currentFilename.startsWith("SPOTL") == 0
+				&& currentFilename.startsWith("TRASH") == 0
+				&& !(firstBank >= 0 && depth == 1 && currentFilename == firstDirectory)
+				&& depth < SCAN_DEPTH) {
+			openDirectory(currentFile, entry, currentFilename);
+			return;
 		}
+	} else {
+		for (int i = 0; i < NUM_FILE_TYPES; ++i) {
+			if (currentFilename.endsWith(fileTypes[i])) {
+				int directoryNumber = currentDirectory.toInt();
+				if (directoryNumber >= BANKS) {
+					// Only banks the LEDs can show
+					skipFile(currentDirectory.c_str());
+					currentFile.close();
+					leaveDirectory();
+					return;
+				}
+				// It may be playing, leave it as it is
+				if (directoryNumber == firstBank) {
+					break;
+				}
+				if (directoryNumber > lastBankIndex) {
+					lastBankIndex = directoryNumber;
+				}
+				char* path = fileNames.start(currentDirectory.c_str(), currentFilename.c_str());
+				if (path == NULL || fileCount == fileCapacity) {
+					skipFile(path == NULL ? currentFilename.c_str() : path, path == NULL ? &namesFull : &tableFull);
+					break;
+				}
 
-		if (currentFile.isDirectory()) {
-			// Ignore OSX Spotlight and Trash Directories
-			if (currentFilename.startsWith("SPOTL") == 0
-					&& currentFilename.startsWith("TRASH") == 0) {
-				currentDirectory = currentFilename;
-				scanDirectory(&currentFile);
-			}
-		} else {
-			for (int i = 0; i < NUM_FILE_TYPES; ++i) {
-				if (currentFilename.endsWith(fileTypes[i])) {
-					int directoryNumber = currentDirectory.toInt();
-					if (directoryNumber >= BANKS) {
-						currentFile.close();
-						return;
-					}
-					if (directoryNumber > lastBankIndex) {
-						lastBankIndex = directoryNumber;
-					}
-					int numFiles = numFilesInBank[directoryNumber];
-
-					AudioFileInfo& fileInfo =
-							fileInfos[directoryNumber][numFiles];
-					// wav / WAV
-					if (i == 2 || i == 3) {
-						addFile = processWavFile(&currentFile, fileInfo);
-					} else {
-						addFile = processRawFile(&currentFile, fileInfo);
-					}
-					if (addFile) {
-
-						fileInfo.name = currentDirectory + "/" + currentFilename;
-						numFilesInBank[directoryNumber]++;
-						D(
-							Serial.print("Adding file ");
-							Serial.print(numFilesInBank[directoryNumber]);
-							Serial.print(" : ");
-							Serial.println(currentFilename);
-						);
-						if (numFilesInBank[directoryNumber] == MAX_FILES) {
-							D(Serial.println("Max Files reached"); );
-							currentFile.close();
-							return;
-						}
-					}
+				AudioFileInfo& fileInfo = files[fileCount];
+				// wav / WAV
+				addFile = processFile(&currentFile, entry, fileInfo, path, i == 2 || i == 3);
+				if (addFile) {
+
+					fileInfo.nameOffset = fileNames.keep();
+					fileInfo.bank = directoryNumber;
+					fileCount++;
+					numFilesInBank[directoryNumber]++;
+					D(
+						Serial.print("Adding file ");
+						Serial.print(numFilesInBank[directoryNumber]);
+						Serial.print(" : ");
+						Serial.println(currentFilename);
+					);
 				}
 			}
 		}
+	}
 
-		currentFile.close();
+	currentFile.close();
+	entry.close();
+}
+
+// The entry the SD library just gave as name, read through SdFat, which can say where it is
+// on the card. They list a directory in the same order. If they've got out of step it isn't
+// opened, and the file is looked up by its path instead.
+FsFile FileScanner::nextEntry(FsFile& dir, const String& name) {
+	FsFile entry;
+	char entryName[256];
+	if (dir.isOpen() && entry.openNext(&dir, O_RDONLY)
+			&& (entry.getName(entryName, sizeof(entryName)) == 0 || strcmp(name.c_str(), entryName) != 0)) {
+		D(Serial.print("Out of step at "); Serial.println(name););
+		entry.close();
+		dir.close();
+	}
+	return entry;
+}
+
+// Files that are left out are always reported. reason counts why, if it's one that's summed up at the end.
+void FileScanner::skipFile(const char* path, uint16_t* reason) {
+	skippedFiles++;
+	if (reason != NULL) (*reason)++;
+	Serial.print("Skipped ");
+	Serial.println(path);
+}
+
+// Takes the file's details from the index if its directory entry hasn't changed,
+// otherwise reads its header. Either way it goes in the new index.
+boolean FileScanner::processFile(File* file, FsFile& entry, AudioFileInfo& fileInfo, const char* path, boolean wav) {
+	uint32_t nameHash = hashName(path);
+	uint32_t fileSize = file->size();
+	uint32_t modified = modifiedStamp(file);
+	boolean valid;
+
+	// The slot may hold a file that wasn't added
+	fileInfo = AudioFileInfo();
+	IndexEntry* indexEntry = findIndexEntry(nameHash);
+	// A copy of the card has the same names, sizes and dates, but the files can be
+	// somewhere else on it. The sector is only kept if the file still starts there.
+	if (indexEntry != NULL && indexEntry->fileSize == fileSize && indexEntry->modified == modified
+			&& (indexEntry->firstSector == 0 || indexEntry->firstSector == startSector(entry, path))) {
+		fileInfo.size = indexEntry->size;
+		fileInfo.sampleRate = indexEntry->sampleRate;
+		fileInfo.dataOffset = indexEntry->dataOffset;
+		fileInfo.firstSector = indexEntry->firstSector;
+		fileInfo.format = indexEntry->format;
+		valid = indexEntry->valid;
+		indexHits++;
+		if (indexEntry != &index[newIndexCount]) indexChanged = true;
+	} else {
+		valid = wav ? processWavFile(file, fileInfo) : processRawFile(file, fileInfo);
+		fileInfo.firstSector = valid ? findFirstSector(entry, path) : 0;
+		indexMisses++;
+		indexChanged = true;
+	}
+
+	if (newIndex != NULL && newIndexCount < indexCapacity()) {
+		IndexEntry& newEntry = newIndex[newIndexCount++];
+		newEntry.nameHash = nameHash;
+		newEntry.fileSize = fileSize;
+		newEntry.modified = modified;
+		newEntry.size = fileInfo.size;
+		newEntry.sampleRate = fileInfo.sampleRate;
+		newEntry.dataOffset = fileInfo.dataOffset;
+		newEntry.firstSector = fileInfo.firstSector;
+		newEntry.format = fileInfo.format;
+		newEntry.valid = valid;
+		newEntry.reserved = 0;
+	}
+
+	if (!valid) return false;
+	return wav ? acceptWavFile(fileInfo) : true;
+}
+
+FileScanner::IndexEntry* FileScanner::findIndexEntry(uint32_t nameHash) {
+	for (uint16_t n = 0; n < indexCount; n++) {
+		uint16_t i = (indexNext + n) % indexCount;
+		if (index[i].nameHash == nameHash) {
+			indexNext = i + 1;
+			return &index[i];
+		}
+	}
+	return NULL;
+}
+
+void FileScanner::loadIndex() {
+	index = NULL;
+	indexCount = 0;
+	indexNext = 0;
+	newIndexCount = 0;
+	indexChanged = false;
+	indexHits = 0;
+	indexMisses = 0;
+
+	File file = SD.open(SCAN_INDEX_FILE);
+	if (!file) {
+		// The power went between removing the old one and renaming the new one.
+		// It's written again under the right name.
+		file = SD.open(SCAN_INDEX_TEMP);
+		indexChanged = true;
+	}
+	if (!file) {
+		D(Serial.println("No scan index"););
+		return;
+	}
+	// Magic, entry size, count
+	uint32_t header[3];
+	if (file.read(header, sizeof(header)) == sizeof(header) && header[0] == SCAN_INDEX_MAGIC
+			&& header[1] == sizeof(IndexEntry) && header[2] <= indexCapacity()) {
+		uint32_t bytes = header[2] * sizeof(IndexEntry);
+		index = (IndexEntry*) malloc(bytes);
+		if (index == NULL) {
+			Serial.println("No memory to load the scan index");
+		}
+		if (index != NULL && (uint32_t) file.read(index, bytes) == bytes) {
+			indexCount = header[2];
+		} else {
+			free(index);
+			index = NULL;
+		}
+	}
+	D(Serial.print("Scan index has "); Serial.print(indexCount); Serial.println(" files"););
+	file.close();
+}
+
+// Writes the new index a sector at a time, for up to micros. Call until indexPending()
+// is false. It goes to a file of its own and is renamed over the old one once it's
+// complete, so a power cut leaves one or the other.
+void FileScanner::saveIndex(uint32_t micros) {
+	if (!savePending) return;
+	elapsedMicros sliceTime;
+	uint32_t bytes = newIndexCount * sizeof(IndexEntry);
+	if (!indexFile) {
+		SD.remove(SCAN_INDEX_TEMP);
+		indexFile = SD.open(SCAN_INDEX_TEMP, FILE_WRITE);
+		uint32_t header[3] = {SCAN_INDEX_MAGIC, sizeof(IndexEntry), newIndexCount};
+		if (!indexFile || indexFile.write(header, sizeof(header)) != sizeof(header)) {
+			D(Serial.println("Can't write the scan index"););
+			endSave();
+			return;
+		}
+	}
+	while (indexSaved < bytes && sliceTime < micros) {
+		uint32_t chunk = min(bytes - indexSaved, (uint32_t) SCAN_INDEX_WRITE);
+		if (indexFile.write((uint8_t*) newIndex + indexSaved, chunk) != chunk) {
+			D(Serial.println("Can't write the scan index"););
+			endSave();
+			SD.remove(SCAN_INDEX_TEMP);
+			return;
+		}
+		indexSaved += chunk;
+	}
+	if (indexSaved < bytes) return;
+
+	indexFile.close();
+	SD.remove(SCAN_INDEX_FILE);
+	SD.rename(SCAN_INDEX_TEMP, SCAN_INDEX_FILE);
+	D(Serial.print("Saved scan index of "); Serial.print(newIndexCount); Serial.println(" files"););
+	endSave();
+}
+
+void FileScanner::endSave() {
+	if (indexFile) indexFile.close();
+	free(newIndex);
+	newIndex = NULL;
+	savePending = false;
+}
+
+// FNV-1a. The size and date have to match as well, so a clash doesn't matter.
+uint32_t FileScanner::hashName(const char* path) {
+	uint32_t hash = 2166136261;
+	for (; *path != 0; path++) {
+		hash = (hash ^ (uint8_t) *path) * 16777619;
 	}
+	return hash;
+}
+
+// Only ever compared, so it doesn't matter that it wraps
+uint32_t FileScanner::modifiedStamp(File* file) {
+	DateTimeFields time;
+	if (!file->getModifyTime(time)) return 0;
+	uint32_t stamp = time.year;
+	stamp = stamp * 12 + time.mon;
+	stamp = stamp * 31 + time.mday;
+	stamp = stamp * 24 + time.hour;
+	stamp = stamp * 60 + time.min;
+	return stamp * 60 + time.sec;
+}
+
+// Where the file starts on the card, if it's in one piece. The players can then
+// work out the sector for any position instead of following the FAT from the start.
+uint32_t FileScanner::findFirstSector(FsFile& entry, const char* path) {
+	FsFile file = entry.isOpen() ? entry : SD.sdfs.open(path, O_RDONLY);
+	if (!file) return 0;
+	uint32_t first = 0;
+	uint32_t last = 0;
+	if (!file.contiguousRange(&first, &last)) {
+		D(Serial.print("Not contiguous : ");Serial.println(path););
+		first = 0;
+	}
+	file.close();
+	return first;
+}
+
+// The first sector of the file's first cluster. It's in the directory entry, so unlike
+// findFirstSector() there are no FAT lookups and it's cheap enough to check the index with.
+uint32_t FileScanner::startSector(FsFile& entry, const char* path) {
+	FsFile file = entry.isOpen() ? entry : SD.sdfs.open(path, O_RDONLY);
+	if (!file) return 0;
+	uint32_t sector = file.firstSector();
+	file.close();
+	return sector;
 }
 
 boolean FileScanner::processRawFile(File* rawFile, AudioFileInfo& fileInfo) {
@@ -229,25 +731,26 @@ boolean FileScanner::processWavFile(File* wavFile, AudioFileInfo& fileInfo) {
 			Serial.print("\tOffset: ");
 			Serial.println(fileInfo.dataOffset);
 		);
-		if (onlyNativeFormat) {
-			if (fileInfo.getChannels() == 1 && fileInfo.getBytesPerSample() == 2
-					&& fileInfo.getSampleRate() == 44100) {
-				return true;
-			} else {
-				return false;
-			}
-		}
-		// We don't handle 96/24 stereo now because its too memory intensive
-		if (fileInfo.getChannels() == 2 && fileInfo.getSampleRate() > 90000
-				&& fileInfo.getBytesPerSample() == 3) {
-			return false;
-		}
+		return true;
+	}
+	return false;
+}
 
-		// Only mono or stereo.
-		if (fileInfo.getChannels() == 1 || fileInfo.getChannels() == 2) {
+// Whether this scan wants a file it could read
+boolean FileScanner::acceptWavFile(AudioFileInfo& fileInfo) {
+	if (onlyNativeFormat) {
+		if (fileInfo.getChannels() == 1 && fileInfo.getBytesPerSample() == 2
+				&& fileInfo.getSampleRate() == 44100) {
 			return true;
+		} else {
+			return false;
 		}
 	}
+	// We don't handle 96/24 or 88.2/24 stereo now because its too memory intensive
+	if (fileInfo.getBandwidth() > MAX_BANDWIDTH) {
+		return false;
+	}
 
-	return false;
+	// Only mono or stereo.
+	return fileInfo.getChannels() == 1 || fileInfo.getChannels() == 2;
 }
@@ -6,30 +6,155 @@
 #include "WavHeaderReader.h"
 #include "Settings.h"
 
+// As many as the LEDs can show
 #define BANKS 16
-#define MAX_FILES 48
+// A TipTop card's files are split into banks of this many
+#define TIPTOP_FILES_PER_BANK 48
+
+// Most bytes per second we'll stream for one file. 96k 16 bit stereo.
+#define MAX_BANDWIDTH (96000 * 2 * 2)
 
 // .raw and .wav but both lower and upper case
 #define NUM_FILE_TYPES 4
 
+// What the last scan found is kept here so the next boot only has to read the
+// headers of files that have changed. Names starting with _ aren't scanned.
+#define SCAN_INDEX_FILE "_index.bin"
+// Written first, then renamed to SCAN_INDEX_FILE
+#define SCAN_INDEX_TEMP "_index.tmp"
+// Bytes of the index written at a time. A sector.
+#define SCAN_INDEX_WRITE 512
+// "RWI3". Change it if IndexEntry or what the header reader makes of a file changes.
+#define SCAN_INDEX_MAGIC 0x33495752
+// Files remembered as well as every file the table can hold, for ones that were left out
+#define SCAN_INDEX_EXTRA 64
+
+// How banks are sorted
+// In the order the files were found
+#define SORT_NONE 0
+// By name
+#define SORT_NAME 1
+// By name, with numbers in order of their value. 2.wav before 10.wav.
+#define SORT_NATURAL 2
+
+// Deepest directories are followed
+#define SCAN_DEPTH 8
+// How long each update() can scan for. A file whose header has to be read takes a few ms.
+#define SCAN_SLICE_US 1000
+
 class FileScanner {
 	public:
 		FileScanner();
+		// Scan the whole card
 		void scan(File* root, Settings& settings);
+		// Scan the first bank's directory now and leave the rest of the card to update()
+		void begin(File* root, Settings& settings, int firstBank);
+		// Scan on for up to micros. Call from loop() until finished().
+		void update(uint32_t micros);
+		// Scan whatever is left
+		void finish();
+		boolean finished() { return scanDone; }
+		// The scan found changes to write to the index, with saveIndex()
+		boolean indexPending() { return savePending; }
+		void saveIndex(uint32_t micros);
+
+		// A file's place in a sort. The key settles most compares without the names.
+		struct SortEntry {
+			uint32_t key;
+			uint16_t index;
+		};
+
+		// A bank's files are together in the table. Only the first bank's are
+		// known until the scan has finished, and they have a table of their own.
+		AudioFileInfo* bankFiles(int bank) {
+			if (bank == firstBank && firstFiles != NULL) return firstFiles;
+			return files != NULL ? &files[bankStart[bank]] : &noFile;
+		}
+		// What the tables take, once the scan has cut them down
+		uint32_t tableBytes() { return ((uint32_t) fileCapacity + (firstFiles != NULL ? firstCount : 0)) * sizeof(AudioFileInfo); }
 
 		int lastBankIndex = 0;
-		AudioFileInfo fileInfos[BANKS][MAX_FILES];
-		int numFilesInBank[BANKS];
+		int numFilesInBank[BANKS] = {};
+		// Files in the table and room for them. It's allocated once, up to the
+		// settings' fileTableKB, and cut down to what was found when the scan's
+		// done. The first bank's files aren't counted once they've been moved out.
+		uint16_t fileCount = 0;
+		uint16_t fileCapacity = 0;
+		// Files left out because the table or name pool were full, or they weren't in a bank
+		uint16_t skippedFiles = 0;
+		// Of those, the ones left out for want of room in the table and in the name pool
+		uint16_t tableFull = 0;
+		uint16_t namesFull = 0;
 
 	private:
-		uint8_t maximumFilesPerBank = MAX_FILES;
-		void scanDirectory(File* dir);
-		void sortFiles();
+		// The host harnesses in test/host look inside through this
+		friend struct HostTest;
+		AudioFileInfo* files = NULL;
+		// What bankFiles() gives if there's no table
+		AudioFileInfo noFile;
+		uint16_t bankStart[BANKS] = {};
+		// Files of the first bank. Moved to firstFiles, just big enough, so the
+		// table can be cut down without moving what's playing. At the start of
+		// the table if there wasn't room.
+		AudioFileInfo* firstFiles = NULL;
+		uint16_t firstCount = 0;
+		void moveFirstBank();
+		void openDirectory(File& dir, FsFile& sdDir, const String& name);
+		FsFile nextEntry(FsFile& dir, const String& name);
+		void leaveDirectory();
+		void scanNext();
+		void sortFiles(uint16_t first);
+		uint32_t sortKey(AudioFileInfo& info);
+		void skipFile(const char* path, uint16_t* reason = NULL);
 		void showSortedFiles();
 
 		void getExtensionlessFilesInRoot(File* root);
+		boolean processFile(File* file, FsFile& entry, AudioFileInfo& fileInfo, const char* path, boolean wav);
 		boolean processWavFile(File* wavFile, AudioFileInfo& fileInfo);
 		boolean processRawFile(File* wavFile, AudioFileInfo& fileInfo);
+		boolean acceptWavFile(AudioFileInfo& fileInfo);
+		uint32_t findFirstSector(FsFile& entry, const char* path);
+		uint32_t startSector(FsFile& entry, const char* path);
+
+		// One file as the last scan found it. The directory entry's size and date
+		// say whether it's changed since.
+		struct IndexEntry {
+			uint32_t nameHash;
+			uint32_t fileSize;
+			uint32_t modified;
+			uint32_t size;
+			uint32_t sampleRate;
+			uint32_t dataOffset;
+			uint32_t firstSector;
+			uint8_t format;
+			// The header could be read. Files that weren't added are remembered too.
+			uint8_t valid;
+			uint16_t reserved;
+		};
+
+		boolean roomFor(uint16_t capacity);
+		uint32_t indexCapacity() { return (uint32_t) fileCapacity + (firstFiles != NULL ? firstCount : 0) + SCAN_INDEX_EXTRA; }
+		void loadIndex();
+		void endSave();
+		IndexEntry* findIndexEntry(uint32_t nameHash);
+		static uint32_t hashName(const char* path);
+		static uint32_t modifiedStamp(File* file);
+
+		// Loaded from the card, and the one being made by this scan
+		IndexEntry* index = NULL;
+		uint16_t indexCount = 0;
+		// Where the next file is likely to be, directories are listed in the same order each time
+		uint16_t indexNext = 0;
+		IndexEntry* newIndex = NULL;
+		uint16_t newIndexCount = 0;
+		boolean indexChanged = false;
+		// newIndex is kept until saveIndex() has written it
+		boolean savePending = false;
+		File indexFile;
+		uint32_t indexSaved = 0;
+		// Files taken from the index and files whose headers were read
+		uint16_t indexHits = 0;
+		uint16_t indexMisses = 0;
 		String fileTypes[4] = {
 				"RAW", "raw", "WAV", "wav"
 		};
@@ -40,6 +165,19 @@ class FileScanner {
 		boolean onlyNativeFormat = false;
 
 		String currentFilename;
+
+		// The directories being scanned, innermost last, and their names
+		File directories[SCAN_DEPTH];
+		// The same directories read through SdFat, for where their files are on the card
+		FsFile sdDirectories[SCAN_DEPTH];
+		String directoryNames[SCAN_DEPTH];
+		uint8_t depth = 0;
+		// Everything's been found and sorted, and the banks are known
+		boolean scanDone = false;
+		// The bank scanned by begin(). It's complete and may be playing.
+		int firstBank = -1;
+		String firstDirectory;
+		elapsedMillis scanTime;
 };
 
 #endif
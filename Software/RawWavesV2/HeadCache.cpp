@@ -0,0 +1,310 @@
+#include "HeadCache.h"
+
+#include "RawWaves.h"
+#include "SDPlayPCM.h"
+
+#ifdef DEBUG_CACHE
+#define D(x) x
+#else
+#define D(x)
+#endif
+
+DMAMEM unsigned char HeadCache::pool[HEAD_CACHE_SIZE] __attribute__ ((aligned (4)));
+DMAMEM unsigned char HeadCache::residentPool[RESIDENT_CACHE_SIZE] __attribute__ ((aligned (4)));
+
+// Share the pool out between the files in proportion to their bandwidth, so
+// every file gets the same length of audio.
+void HeadCache::setBank(AudioFileInfo* files, uint16_t count, boolean radioMode) {
+	bankFiles = files;
+	bankCount = count;
+	headCount = min(count, (uint16_t) HEAD_CACHE_FILES);
+
+	// Short files first. Their heads aren't needed.
+	bankStamp++;
+	residentCount = 0;
+	for (uint16_t i = 0; i < count; i++) {
+		if (files[i].size > 0 && files[i].size <= residentLimit && makeResident(&files[i])) {
+			residentCount++;
+		}
+	}
+
+	uint32_t totalBandwidth = 0;
+	uint32_t maxBandwidth = 0;
+	// Heads that aren't kept whole
+	uint16_t streamed = 0;
+	for (uint16_t i = 0; i < count; i++) {
+		uint32_t bandwidth = files[i].getBandwidth();
+		if (bandwidth > maxBandwidth) maxBandwidth = bandwidth;
+		if (i < headCount && findResident(&files[i]) == NULL) {
+			totalBandwidth += bandwidth;
+			streamed++;
+		}
+	}
+
+	radioCount = radioMode && maxBandwidth <= RADIO_CACHE_MAX_BANDWIDTH ? RADIO_CACHE_SLOTS : 0;
+	radioBytes = maxBandwidth * RADIO_CACHE_MS / 1000;
+	radioBytes -= radioBytes % 4;
+	// Each head also covers a player's smallest read, as rings are made that much
+	// bigger. Less that, and what word aligning the heads could take.
+	uint32_t space = HEAD_CACHE_SIZE - radioCount * radioBytes - headCount * 3
+			- streamed * PREFETCH_MIN_READ;
+
+	uint32_t ms = HEAD_CACHE_MS;
+	if (totalBandwidth > 0 && totalBandwidth * ms / 1000 > space) {
+		ms = (uint64_t) space * 1000 / totalBandwidth;
+	}
+	headMs = ms;
+
+	uint32_t offset = 0;
+	for (uint16_t i = 0; i < headCount; i++) {
+		Entry& head = heads[i];
+		uint32_t frameBytes = files[i].getBytesPerFrame();
+		uint32_t length = files[i].getBandwidth() * ms / 1000 + PREFETCH_MIN_READ;
+		length -= length % frameBytes;
+		if (length > files[i].size) length = files[i].size;
+		if (findResident(&files[i]) != NULL) length = 0;
+		head.info = &files[i];
+		head.position = 0;
+		head.length = length;
+		head.filled = 0;
+		head.data = &pool[offset];
+		// Keep every entry word aligned
+		offset += (length + 3) & ~3;
+	}
+	for (uint16_t i = 0; i < radioCount; i++) {
+		radio[i].info = NULL;
+		radio[i].filled = 0;
+		radio[i].data = &pool[offset];
+		offset += radioBytes;
+	}
+
+	// Anything being read belongs to the old bank
+	file.close();
+	fileInfo = NULL;
+
+	D(
+		Serial.print("HC: Bank of ");
+		Serial.print(count);
+		Serial.print(" files. Head ms ");
+		Serial.print(headMs);
+		Serial.print(" . Whole files ");
+		Serial.print(residentCount);
+		Serial.print(" . Radio windows ");
+		Serial.print(radioCount);
+		Serial.print(" of ");
+		Serial.print(radioBytes);
+		Serial.print(" . Bytes used ");
+		Serial.println(offset);
+	);
+}
+
+// The radio windows are for the channels either side of this one.
+void HeadCache::setChannel(AudioFileInfo* info) {
+	if (radioCount == 0 || info < bankFiles || info >= bankFiles + bankCount) return;
+	int16_t channel = info - bankFiles;
+	AudioFileInfo* neighbours[RADIO_CACHE_SLOTS] = {
+		channel > 0 ? info - 1 : NULL,
+		channel + 1 < bankCount ? info + 1 : NULL
+	};
+	for (uint16_t i = 0; i < radioCount; i++) {
+		if (radio[i].info != neighbours[i]) {
+			radio[i].info = neighbours[i];
+			radio[i].length = 0;
+			radio[i].filled = 0;
+		}
+	}
+}
+
+// A radio window needs filling again once the radio position is too close to its end
+// for a player to fill its ring from it. Windows start a little ahead of the station
+// to allow for filling them, so it's been reached once that lead has.
+boolean HeadCache::needsRadioFill(Entry& entry, uint64_t radioMicros) {
+	AudioFileInfo* info = entry.info;
+	uint32_t frameBytes = info->getBytesPerFrame();
+	uint32_t position = info->frameAt(radioMicros) * frameBytes;
+	uint32_t ahead = info->frameAt(radioMicros + RADIO_CACHE_LEAD_MS * 1000) * frameBytes;
+	uint32_t needed = info->getBandwidth() * HEAD_CACHE_MS / 1000;
+	if (needed > info->size - position) needed = info->size - position;
+	if (entry.length > 0 && ahead >= entry.position && position + needed <= entry.position + entry.length) {
+		return entry.filled < entry.length;
+	}
+
+	entry.position = ahead;
+	entry.length = info->getBandwidth() * RADIO_CACHE_MS / 1000;
+	if (entry.length > radioBytes) entry.length = radioBytes;
+	entry.length -= entry.length % frameBytes;
+	if (entry.length > info->size - entry.position) entry.length = info->size - entry.position;
+	entry.filled = 0;
+	return entry.length > 0;
+}
+
+// The whole file entry for info. With NULL, a free one.
+HeadCache::Entry* HeadCache::findResident(AudioFileInfo* info) {
+	for (uint16_t i = 0; i < RESIDENT_FILES; i++) {
+		if (resident[i].info == info) return &resident[i];
+	}
+	return NULL;
+}
+
+// Keep the file whole, unless there's no room even after dropping the files
+// from every other bank.
+boolean HeadCache::makeResident(AudioFileInfo* info) {
+	Entry* entry = findResident(info);
+	if (entry == NULL) {
+		uint32_t bytes = info->size;
+		if (bytes > RESIDENT_CACHE_SIZE) return false;
+		int32_t offset = findRoom(bytes);
+		entry = findResident(NULL);
+		while (offset < 0 || entry == NULL) {
+			// Drop the file whose bank was chosen longest ago
+			Entry* oldest = NULL;
+			for (uint16_t i = 0; i < RESIDENT_FILES; i++) {
+				Entry& candidate = resident[i];
+				if (candidate.info != NULL && candidate.lastUsed < bankStamp
+						&& (oldest == NULL || candidate.lastUsed < oldest->lastUsed)) {
+					oldest = &candidate;
+				}
+			}
+			if (oldest == NULL) return false;
+			D(
+				Serial.print("HC: Dropping ");
+				Serial.println(oldest->info->getName());
+			);
+			oldest->info = NULL;
+			offset = findRoom(bytes);
+			entry = findResident(NULL);
+		}
+		entry->info = info;
+		entry->position = 0;
+		entry->length = bytes;
+		entry->filled = 0;
+		entry->data = &residentPool[offset];
+	}
+	entry->lastUsed = bankStamp;
+	return true;
+}
+
+// Where there's a gap of this many bytes in the resident pool, or -1.
+// Gaps can only start at the start of the pool or the end of a file.
+int32_t HeadCache::findRoom(uint32_t bytes) {
+	for (int16_t i = -1; i < RESIDENT_FILES; i++) {
+		uint32_t start = 0;
+		if (i >= 0) {
+			if (resident[i].info == NULL) continue;
+			start = resident[i].data - residentPool + resident[i].length;
+			// Keep every file word aligned
+			start = (start + 3) & ~3;
+		}
+		if (start + bytes > RESIDENT_CACHE_SIZE) continue;
+		boolean clear = true;
+		for (uint16_t j = 0; j < RESIDENT_FILES; j++) {
+			if (resident[j].info == NULL) continue;
+			uint32_t begin = resident[j].data - residentPool;
+			if (start < begin + resident[j].length && begin < start + bytes) {
+				clear = false;
+				break;
+			}
+		}
+		if (clear) return start;
+	}
+	return -1;
+}
+
+// One read per call. The radio windows go first as they go out of date, then
+// this bank's whole files.
+void HeadCache::update(uint64_t radioMicros) {
+	if (reader != NULL && !reader->idle()) return;
+	for (uint16_t i = 0; i < radioCount; i++) {
+		if (radio[i].info != NULL && needsRadioFill(radio[i], radioMicros)) {
+			fill(radio[i]);
+			return;
+		}
+	}
+	for (uint16_t i = 0; i < RESIDENT_FILES; i++) {
+		Entry& whole = resident[i];
+		if (whole.info != NULL && whole.lastUsed == bankStamp && whole.filled < whole.length) {
+			fill(whole);
+			return;
+		}
+	}
+	for (uint16_t i = 0; i < headCount; i++) {
+		if (heads[i].filled < heads[i].length) {
+			fill(heads[i]);
+			return;
+		}
+	}
+}
+
+void HeadCache::fill(Entry& entry) {
+	uint32_t position = entry.position + entry.filled;
+	if (fileInfo != entry.info) {
+		file.close();
+		file = SD.open(entry.info->getName());
+		if (!file) {
+			D(
+				Serial.print("HC: Can't open ");
+				Serial.println(entry.info->getName());
+			);
+			// Don't try again
+			entry.info = NULL;
+			entry.length = entry.filled;
+			fileInfo = NULL;
+			return;
+		}
+		fileInfo = entry.info;
+		file.seek(entry.info->dataOffset + position);
+		filePosition = position;
+	} else if (filePosition != position) {
+		file.seek(entry.info->dataOffset + position);
+		filePosition = position;
+	}
+
+	uint32_t length = entry.length - entry.filled;
+	if (length > HEAD_CACHE_READ) {
+		length = HEAD_CACHE_READ;
+		// Finish on a sector boundary, so the next read is whole sectors
+		uint32_t partial = (entry.info->dataOffset + position + length) % SD_SECTOR;
+		if (partial < length) length -= partial;
+	}
+	int32_t got = file.read(&entry.data[entry.filled], length);
+	if (got <= 0) {
+		D(
+			Serial.print("HC: Read error in ");
+			Serial.println(entry.info->getName());
+		);
+		entry.length = entry.filled;
+		return;
+	}
+	entry.filled += got;
+	filePosition += got;
+}
+
+uint32_t HeadCache::find(AudioFileInfo* info, uint32_t dataPosition, const unsigned char** data) {
+	if (info == NULL) return 0;
+	Entry* whole = findResident(info);
+	if (whole != NULL && dataPosition < whole->filled) {
+		*data = &whole->data[dataPosition];
+		return whole->filled - dataPosition;
+	}
+	if (info >= bankFiles && info < bankFiles + headCount) {
+		Entry& head = heads[info - bankFiles];
+		if (dataPosition < head.filled) {
+			*data = &head.data[dataPosition];
+			return head.filled - dataPosition;
+		}
+	}
+	for (uint16_t i = 0; i < radioCount; i++) {
+		Entry& window = radio[i];
+		if (window.info == info && dataPosition >= window.position && dataPosition < window.position + window.filled) {
+			*data = &window.data[dataPosition - window.position];
+			return window.position + window.filled - dataPosition;
+		}
+	}
+	return 0;
+}
+
+boolean HeadCache::isResident(AudioFileInfo* info) {
+	if (info == NULL) return false;
+	Entry* whole = findResident(info);
+	return whole != NULL && whole->length > 0 && whole->filled == whole->length;
+}
@@ -0,0 +1,106 @@
+#ifndef HeadCache_h
+#define HeadCache_h
+
+#include <SD.h>
+#include "AudioFileInfo.h"
+#include "FileScanner.h"
+#include "SDReader.h"
+
+// Keeps the start of every file in the bank in RAM, so a player can start on
+// a new file straight away and open and seek on the SD card once it's full.
+// Short files are kept whole, so playing them never touches the card at all.
+
+// The cache lives in RAM2 (OCRAM). That's 512K on the Teensy 4.0 but the heap is there too.
+// This, RESIDENT_CACHE_SIZE and NAME_POOL_SIZE take 400K of it, which leaves the heap
+// about 112K. The file table and the two scan indexes come out of that, and
+// FileScanner::begin() makes the table smaller if they wouldn't fit.
+#define HEAD_CACHE_SIZE (256 * 1024)
+// Audio cached from the start of each file, if the bank fits, plus the players'
+// PREFETCH_MIN_READ. Twice their READ_AHEAD_MS so a player has filled its ring
+// before it needs the card.
+#define HEAD_CACHE_MS 50
+// In radio mode the channels either side of the current one also get a window of
+// audio from their radio position. It's refilled before the position runs out of it.
+#define RADIO_CACHE_MS 250
+#define RADIO_CACHE_SLOTS 2
+// Windows start this far ahead of the radio position to allow for filling them
+#define RADIO_CACHE_LEAD_MS 20
+// Keeping the windows filled costs about as much card bandwidth as playing the
+// neighbours, so only banks that don't need much get them. 44k 16 bit stereo.
+#define RADIO_CACHE_MAX_BANDWIDTH (44100 * 2 * 2)
+// Most read in one go, so loop() isn't held up for long
+#define HEAD_CACHE_READ 2048
+
+// RAM for whole files. Also in RAM2. They stay in it across bank changes until
+// the room is needed, least recently chosen bank first.
+#define RESIDENT_CACHE_SIZE (128 * 1024)
+// Most files kept whole at once
+#define RESIDENT_FILES 32
+// Files in a bank that get a head. Any after that start from the card.
+#define HEAD_CACHE_FILES 48
+
+class HeadCache {
+	public:
+		// Plan the cache for a bank. Nothing is read until update().
+		void setBank(AudioFileInfo* files, uint16_t count, boolean radio);
+		// Follow the channel being played, for the radio windows.
+		void setChannel(AudioFileInfo* info);
+		// Read a little more into the cache. Call from loop() after the players are topped up.
+		void update(uint64_t radioMicros);
+		// Bytes cached for info from dataPosition on. data is set to the first of them.
+		uint32_t find(AudioFileInfo* info, uint32_t dataPosition, const unsigned char** data);
+		// The whole file has been read into RAM
+		boolean isResident(AudioFileInfo* info);
+
+		// Files up to this size are kept whole. 0 for none.
+		uint32_t residentLimit = 0;
+		// The card's left alone while this has DMA reads going
+		SDReader* reader = NULL;
+		// Milliseconds of each file that fit for this bank.
+		uint16_t headMs = 0;
+		// Files in the bank that are kept whole
+		uint16_t residentCount = 0;
+		// Starts that were, or weren't, in the cache. Counted by the players.
+		uint16_t hits = 0;
+		uint16_t misses = 0;
+
+	private:
+		struct Entry {
+			AudioFileInfo* info = NULL;
+			// Where the cached audio starts in the file's data, in bytes
+			uint32_t position = 0;
+			// Bytes wanted, and bytes read so far
+			uint32_t length = 0;
+			uint32_t filled = 0;
+			unsigned char* data = NULL;
+			// When the file's bank was last chosen. Only used for whole files.
+			uint32_t lastUsed = 0;
+		};
+
+		void fill(Entry& entry);
+		boolean needsRadioFill(Entry& entry, uint64_t radioMicros);
+		Entry* findResident(AudioFileInfo* info);
+		boolean makeResident(AudioFileInfo* info);
+		int32_t findRoom(uint32_t bytes);
+
+		static unsigned char pool[HEAD_CACHE_SIZE];
+		Entry heads[HEAD_CACHE_FILES];
+		Entry radio[RADIO_CACHE_SLOTS];
+		static unsigned char residentPool[RESIDENT_CACHE_SIZE];
+		Entry resident[RESIDENT_FILES];
+		// Counts bank changes, for the resident files' lastUsed
+		uint32_t bankStamp = 0;
+		// Files in the bank, and the first of them that get heads
+		uint16_t bankCount = 0;
+		uint16_t headCount = 0;
+		uint16_t radioCount = 0;
+		uint32_t radioBytes = 0;
+		AudioFileInfo* bankFiles = NULL;
+
+		// File being read into the cache, and where it's got to in its data
+		File file;
+		AudioFileInfo* fileInfo = NULL;
+		uint32_t filePosition = 0;
+};
+
+#endif
@@ -0,0 +1,36 @@
+#include "NamePool.h"
+
+// With the other big buffers, out of the way of the stack and the ring buffers
+DMAMEM static char namePool[NAME_POOL_SIZE];
+
+NamePool fileNames;
+
+NamePool::NamePool() {
+	pool = namePool;
+	// Offset 0 is the empty name
+	pool[0] = 0;
+	used = 1;
+	started = 1;
+}
+
+char* NamePool::start(const char* directory, const char* file) {
+	uint16_t directoryLength = directory == NULL ? 0 : strlen(directory) + 1;
+	uint16_t fileLength = strlen(file) + 1;
+	if ((uint32_t) used + directoryLength + fileLength > NAME_POOL_SIZE) {
+		return NULL;
+	}
+	char* name = &pool[used];
+	if (directory != NULL) {
+		memcpy(name, directory, directoryLength - 1);
+		name[directoryLength - 1] = '/';
+	}
+	memcpy(name + directoryLength, file, fileLength);
+	started = used + directoryLength + fileLength;
+	return name;
+}
+
+uint16_t NamePool::keep() {
+	uint16_t offset = used;
+	used = started;
+	return offset;
+}
@@ -0,0 +1,33 @@
+#ifndef NamePool_h
+#define NamePool_h
+
+#include <Arduino.h>
+
+// Every file name the scan finds, one after another in one block. An
+// AudioFileInfo only holds its name's offset, so nothing is allocated per file.
+// Names are never taken out, the pool is filled once at boot.
+
+// About 21 bytes for each of 768 files. Files that don't fit are left out.
+#define NAME_POOL_SIZE 16384
+
+class NamePool {
+	public:
+		NamePool();
+		// Write directory/file at the end of the pool without keeping it.
+		// directory can be NULL. NULL if there isn't room.
+		char* start(const char* directory, const char* file);
+		// Keep the name last started. Returns its offset.
+		uint16_t keep();
+		const char* get(uint16_t offset) { return &pool[offset]; }
+
+		// Bytes kept so far
+		uint16_t used = 0;
+
+	private:
+		char* pool;
+		uint16_t started = 0;
+};
+
+extern NamePool fileNames;
+
+#endif
@@ -6,8 +6,8 @@
 class PlayState {
 public:
 	uint8_t	bank = 0;
-	uint8_t currentChannel = 0;
-	uint8_t nextChannel = 0;
+	uint16_t currentChannel = 0;
+	uint16_t nextChannel = 0;
 	boolean channelChanged = true;
 
 	void printDebug();
@@ -11,9 +11,13 @@
 //#define DEBUG_FILES
 //#define DEBUG_PCM_PLAYER
 //#define DEBUG_AUDIO_BUFFER
+//#define DEBUG_CACHE
+//#define DEBUG_SD_READER
 
 // Regularly check CPU and report via serial
 //#define CHECK_CPU
+// Count CPU cycles spent in the PCM player decode loops. Reported by AudioEngine::measure()
+//#define MEASURE_DECODE
 
 // Test config modes
 //#define TEST_RADIO_MODE
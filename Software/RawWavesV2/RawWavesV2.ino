@@ -72,6 +72,10 @@ elapsedMillis ledFlashTimer = 0;
 elapsedMillis meterDisplayDelayTimer; // Counter to hide MeterDisplay after bank change
 elapsedMillis peakDisplayTimer; // COUNTER FOR PEAK METER FRAMERATE
 
+#ifdef MEASURE_DECODE
+elapsedMillis measureTimer; // How often decode cycle counts are reported
+#endif
+
 
 boolean bankChangeMode = false;
 File settingsFile;
@@ -110,11 +114,20 @@ void setup() {
 
 	settings.init();
 
-	File root = SD.open("/");
-	fileScanner.scan(&root, settings);
-
+	// The saved bank is scanned first so it can start playing,
+	// the rest of the card is scanned from loop()
 	getSavedBankPosition();
 
+	File root = SD.open("/");
+	fileScanner.begin(&root, settings, playState.bank);
+	if(fileScanner.numFilesInBank[playState.bank] == 0) {
+		// Nothing to play yet, so wait for the rest
+		fileScanner.finish();
+		if(playState.bank > fileScanner.lastBankIndex) {
+			playState.bank = 0;
+		}
+	}
+
 	audioEngine.init(settings);
 
 	int numFiles = 0;
@@ -138,7 +151,9 @@ void setup() {
 		D(Serial.print("Set bank to ");Serial.println(playState.bank););
 	}
 
-	interface.init(fileScanner.fileInfos[playState.bank][0].size, fileScanner.numFilesInBank[playState.bank], settings, &playState);
+	audioEngine.setBank(fileScanner.bankFiles(playState.bank), fileScanner.numFilesInBank[playState.bank]);
+
+	interface.init(fileScanner.bankFiles(playState.bank)[0].size, fileScanner.numFilesInBank[playState.bank], settings, &playState);
 
 	D(Serial.println("--READY--"););
 }
@@ -147,13 +162,10 @@ void getSavedBankPosition() {
 	// CHECK FOR SAVED BANK POSITION
 	int a = 0;
 	a = EEPROM.read(EEPROM_BANK_SAVE_ADDRESS);
-	if (a >= 0 && a <= fileScanner.lastBankIndex) {
+	if (a >= 0 && a < BANKS) {
 		D(
 			Serial.print("Using bank from EEPROM ");
-			Serial.print(a);
-			Serial.print(" . Active banks ");
-			Serial.println(fileScanner.lastBankIndex);
-
+			Serial.println(a);
 		);
 		playState.bank = a;
 		playState.channelChanged = true;
@@ -163,10 +175,10 @@ void getSavedBankPosition() {
 }
 
 boolean openSDCard() {
-	if (!(SD.begin(SS))) { // SS is the SPI chip select pin
+	if (!(SD.begin(SD_CHIP_SELECT))) {
 
 		Serial.println("No SD.");
-		while (!(SD.begin(SS))) { // SS is the SPI chip select pin
+		while (!(SD.begin(SD_CHIP_SELECT))) {
 			ledControl.single(15);
 			delay(SD_CARD_CHECK_DELAY);
 			ledControl.single(rebootCounter % 4); // Modulo 4 on reboot counter. 0,1,2,3,0,1,2,3,0,1,2,3...
@@ -189,6 +201,13 @@ void loop() {
 //	audioEngine.measure();
 	#endif
 
+	#ifdef MEASURE_DECODE
+	if(measureTimer > 3000) {
+		audioEngine.measure();
+		measureTimer = 0;
+	}
+	#endif
+
 	if(NO_FILES) {
 		// TODO : Flash the lights to show there are no files
 		if(ledFlashTimer > 100) {
@@ -209,6 +228,12 @@ void loop() {
 
 	audioEngine.update();
 
+	if(!fileScanner.finished() && audioEngine.sdIdle()) {
+		fileScanner.update(SCAN_SLICE_US);
+	} else if(fileScanner.indexPending() && audioEngine.cardIdle()) {
+		fileScanner.saveIndex(SCAN_SLICE_US);
+	}
+
 	if(audioEngine.error) {
 		// Too many read errors, reboot
 		Serial.println("Audio Engine errors. Reboot");
@@ -225,7 +250,7 @@ void loop() {
 
 		playState.currentChannel = playState.nextChannel;
 
-		AudioFileInfo* currentFileInfo = &fileScanner.fileInfos[playState.bank][playState.nextChannel];
+		AudioFileInfo* currentFileInfo = &fileScanner.bankFiles(playState.bank)[playState.nextChannel];
 
 		audioEngine.changeTo(currentFileInfo, interface.start);
 		playState.channelChanged = false;
@@ -327,8 +352,31 @@ void doSpeedChange() {
 	audioEngine.setPlaybackSpeed(speed);
 }
 
+// The other banks aren't known until the scan's done. Keep playing while it finishes.
+void finishScan() {
+	while(!fileScanner.finished()) {
+		audioEngine.update();
+		if(audioEngine.sdIdle()) {
+			fileScanner.update(SCAN_SLICE_US);
+		}
+	}
+}
+
+// Write the scan index if nothing's been quiet enough for it yet. The bank's changing,
+// so a gap in what was playing matters least now.
+void saveScanIndex() {
+	while(fileScanner.indexPending()) {
+		audioEngine.update();
+		if(audioEngine.sdIdle()) {
+			fileScanner.saveIndex(SCAN_SLICE_US);
+		}
+	}
+}
+
 void nextBank() {
 
+	finishScan();
+	saveScanIndex();
 	if(fileScanner.lastBankIndex == 0) { // Only 1 bank. Don't do anything.
 		D(Serial.println("Only 1 bank."););
 		return;
@@ -346,6 +394,7 @@ void nextBank() {
 		playState.nextChannel = fileScanner.numFilesInBank[playState.bank] - 1;
 
 	interface.setChannelCount(fileScanner.numFilesInBank[playState.bank]);
+	audioEngine.setBank(fileScanner.bankFiles(playState.bank), fileScanner.numFilesInBank[playState.bank]);
 	playState.channelChanged = true;
 
 	D(
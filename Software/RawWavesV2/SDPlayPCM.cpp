@@ -25,10 +25,15 @@
  */
 
 #include "SDPlayPCM.h"
+#include "HeadCache.h"
 
-#include "spi_interrupt.h"
 #include "RawWaves.h"
 
+#if defined(__ARM_ARCH_7EM__)
+// __SHADD16
+#include <arm_math.h>
+#endif
+
 #ifdef DEBUG_PCM_PLAYER
 #define D(x) x
 #else
@@ -41,9 +46,14 @@
 #define B(x)
 #endif
 
+#ifdef MEASURE_DECODE
+#define M(x) x
+#else
+#define M(x)
+#endif
+
 
 void SDPlayPCM::begin(void) {
-//	AudioStartUsingSPI();
 	playing = false;
 	finished = false;
 	errors = 0;
@@ -51,40 +61,54 @@ void SDPlayPCM::begin(void) {
 	filename = "--------";
 }
 
+void SDPlayPCM::setInterpolation(uint8_t mode) {
+	if (mode > INTERPOLATION_SINC) mode = INTERPOLATION_SINC;
+	if (mode == INTERPOLATION_SINC) buildSincTable();
+	interpolation = mode;
+}
+
+void SDPlayPCM::setStereoMode(uint8_t mode) {
+	if (mode > STEREO_MODE_MONO) mode = STEREO_MODE_STEREO;
+	stereoMode = mode;
+}
+
 void SDPlayPCM::loopPlayback(bool loop) {
-	__disable_irq()
-	;
 	looping = loop;
-	__enable_irq()
-	;
 }
 
+// The file is opened by prefetch(), after anything that's cached has been played.
 bool SDPlayPCM::changeFileTo(AudioFileInfo* info, bool closeFirst) {
-	filename = info->name;
-//	AudioStopUsingSPI();
-	__disable_irq()
-	;
+	// The ring may move. Let any read into it finish first. The engine has
+	// usually waited already, so the audio isn't held up here.
+	waitIdle();
+	readPending = false;
+	// Where FileScanner found the file on the card. No FAT lookups, so skips don't wait for them.
+	firstSector = reader != NULL ? info->firstSector : 0;
+
+	filename = info->getName();
+	fileInfo = info;
 	if (closeFirst) {
 		rawfile.close();
 	}
-	rawfile = SD.open(info->name.c_str());
+	openPending = true;
 
 	dataSize = info->size;
 	bytesLeftInFile = info->size;
 	dataOffset = info->dataOffset;
-	channels = info->getChannels();
-	bytesPerSample = info->getBytesPerSample();
-	sampleRateSpeed = (float) info->getSampleRate() / 44100.0;
-	bytesAvailable = 0;
-	readPositionInBytes = 0;
-	bufferFillPosition = 0;
-	finished = false;
-	readError = false;
-	__enable_irq()
-	;
-//	AudioStartUsingSPI();
+	fileFormat.channels = info->getChannels();
+	fileFormat.bytesPerSample = info->getBytesPerSample();
+	uint8_t sampleType = info->isFloat() ? SAMPLE_FLOAT32 : fileFormat.bytesPerSample;
+	fileFormat.kernels = selectKernels(sampleType, fileFormat.channels, false);
+	fileFormat.mixKernels = fileFormat.channels == 2 ? selectKernels(sampleType, 2, true) : NULL;
+	fileFormat.sampleRateSpeed = (float) info->getSampleRate() / 44100.0;
+	fileFormat.frames = dataSize / (fileFormat.bytesPerSample * fileFormat.channels);
+	if (!allocateRing(info)) {
+		// What was playing had its ring given up
+		playing = false;
+		return false;
+	}
 	D(
-		if (dataSize % bytesPerSample != 0) {
+		if (dataSize % fileFormat.bytesPerSample != 0) {
 			debugHeader();
 			Serial.print("!!!! Data size not aligned : ");
 			Serial.print(dataSize);
@@ -95,64 +119,226 @@ bool SDPlayPCM::changeFileTo(AudioFileInfo* info, bool closeFirst) {
 		}
 		debugHeader();
 		Serial.print("Change File To ");
-		Serial.print(info->name);
+		Serial.print(info->getName());
 		Serial.print(". BPS ");
-		Serial.print(bytesPerSample);
+		Serial.print(fileFormat.bytesPerSample);
 		Serial.print(". BLIF ");
 		Serial.print(bytesLeftInFile);
 		Serial.print(" .SampleRateSpeed ");
-		Serial.print(sampleRateSpeed);
+		Serial.print(fileFormat.sampleRateSpeed);
 		Serial.print(" .Bytes Per Block ");
-		Serial.println(
-				ceil(AUDIO_BLOCK_SAMPLES * speed * bytesPerSample * channels));
+		Serial.print(
+				ceil(AUDIO_BLOCK_SAMPLES * speed * fileFormat.bytesPerSample * fileFormat.channels));
+		Serial.print(" .Ring ");
+		Serial.print(ringOffset);
+		Serial.print(" + ");
+		Serial.println(ringSize);
 	);
 	return true;
 }
 
-bool SDPlayPCM::skipTo(uint32_t dataPosition) {
-	if(!rawfile) return false;
-	uint32_t pos = dataOffset + dataPosition;
-	AudioStopUsingSPI();
-	__disable_irq()
-	;
-	boolean didseek = rawfile.seek(pos);
-	bytesLeftInFile = dataSize - dataPosition;
-	readPositionInBytes = 0;
-	bytesAvailable = 0;
-	bufferFillPosition = 0;
-	readError = false;
-	playing = true;
-	finished = false;
-	__enable_irq()
-	;
-	AudioStartUsingSPI();
-	if(!didseek) {
+// The ring buffers for all players come out of one pool, sized for each file as it's opened.
+// Rings start at multiples of RING_FRAME_ALIGN, so they're word aligned too.
+unsigned char SDPlayPCM::ringPool[RING_POOL_SIZE] __attribute__ ((aligned (4)));
+SDPlayPCM* SDPlayPCM::firstPlayer = NULL;
+
+// Pick a ring size for the file's bandwidth. It must always hold a block at the fastest
+// playback speed. Past that, ask for READ_AHEAD_MS of audio at the current speed.
+// False if no gap in the pool is big enough, then the player has no ring.
+bool SDPlayPCM::allocateRing(AudioFileInfo* info) {
+	uint32_t frameBytes = info->getBytesPerSample() * info->getChannels();
+	uint32_t reserved = RING_HISTORY + PREFETCH_MIN_READ;
+	uint32_t blockFrames = AUDIO_BLOCK_SAMPLES * MAX_PLAYBACK_SPEED * fileFormat.sampleRateSpeed;
+	uint32_t minimum = (blockFrames + 1 + RESAMPLE_REACH) * frameBytes + reserved;
+	uint32_t desired = info->getBandwidth() * playbackSpeed * READ_AHEAD_MS / 1000 + reserved;
+
+	// Release ours, then find the biggest gap between the other players' rings.
+	// Ours is safe to reuse. update() only reads the ring for the current epoch
+	// and nothing is written until the next one starts. So are the rings of players
+	// that have stopped, once no read is on its way into them.
+	ringSize = 0;
+	uint32_t spare = RING_POOL_SIZE;
+	uint32_t waiting = 0;
+	for (SDPlayPCM* p = firstPlayer; p != NULL; p = p->nextPlayer) {
+		if (p->ringSize > 0 && !p->playing && (!p->readPending || p->readDone)) {
+			p->ringSize = 0;
+			p->readPending = false;
+		}
+		spare -= p->ringSize;
+		if (p != this && p->ringSize == 0) waiting++;
+	}
+	// Leave enough for the players without a ring to start one, when it's fast
+	// playback of a big format that wants more
+	if (desired + waiting * RING_MAX_MINIMUM > spare && spare > waiting * RING_MAX_MINIMUM) {
+		desired = spare - waiting * RING_MAX_MINIMUM;
+	}
+	// Nearest whole number of sectors, that still holds the minimum
+	desired += RING_SECTOR_ALIGN / 2;
+	desired -= desired % RING_SECTOR_ALIGN;
+	while (desired < minimum) desired += RING_SECTOR_ALIGN;
+
+	uint32_t bestStart = 0;
+	uint32_t bestSize = 0;
+	SDPlayPCM* candidate = NULL;
+	do {
+		uint32_t start = candidate == NULL ? 0 : candidate->ringOffset + candidate->ringSize;
+		uint32_t end = RING_POOL_SIZE;
+		for (SDPlayPCM* p = firstPlayer; p != NULL; p = p->nextPlayer) {
+			if (p->ringSize == 0) continue;
+			if (p->ringOffset <= start && p->ringOffset + p->ringSize > start) {
+				// Inside someone else's ring
+				end = start;
+				break;
+			}
+			if (p->ringOffset > start && p->ringOffset < end) end = p->ringOffset;
+		}
+		if (end - start > bestSize) {
+			bestStart = start;
+			bestSize = end - start;
+		}
+		candidate = candidate == NULL ? firstPlayer : candidate->nextPlayer;
+		while (candidate != NULL && candidate->ringSize == 0) candidate = candidate->nextPlayer;
+	} while (candidate != NULL);
+
+	uint32_t size = bestSize < desired ? bestSize : desired;
+	// Keep frames from straddling the end of the ring, and the ring whole sectors if it can be
+	size -= size % (size >= RING_SECTOR_ALIGN ? RING_SECTOR_ALIGN : RING_FRAME_ALIGN);
+	fileFormat.ring = &ringPool[bestStart];
+	fileFormat.ringSize = 0;
+	noRingRoom = size < minimum;
+	if (size < minimum) {
+		// The decoder would read past what the ring holds. The other players' rings
+		// are in the way, one of them has to stop first.
 		D(
 			debugHeader();
-			Serial.println("!!! didseek is false");
+			Serial.print("!!! No room for a ring. ");
+			Serial.print(bestSize);
+			Serial.print(" < ");
+			Serial.println(minimum);
 		);
 		return false;
 	}
+
+	ringOffset = bestStart;
+	ringSize = size;
+	fileFormat.ringSize = ringSize;
+	return true;
+}
+
+// Silence in the ring for RESAMPLE_REACH frames from position, wrapping at its end.
+// Interpolation reads it past either end of a stream, instead of whatever was left there.
+void SDPlayPCM::silenceRing(int32_t position) {
+	unsigned char* ring = fileFormat.ring;
+	int32_t size = fileFormat.ringSize;
+	int32_t bytes = RESAMPLE_REACH * fileFormat.bytesPerSample * fileFormat.channels;
+	// 8 bit WAV is unsigned
+	uint8_t silence = fileFormat.bytesPerSample == 1 ? 128 : 0;
+	if (position < 0) position += size;
+	int32_t first = size - position;
+	if (first > bytes) first = bytes;
+	memset(&ring[position], silence, first);
+	memset(ring, silence, bytes - first);
+}
+
+// Start a new stream in the ring buffer. Everything written before
+// this is dropped by update() as soon as it sees the new epoch.
+void SDPlayPCM::startStream() {
+	uint32_t epoch = (RING_EPOCH(writeState) + 1) & RING_EPOCH_MASK;
+
+	// The frames before the start, until a read that starts part way into a sector
+	// brings in the real ones. It's in the history prefetch() leaves alone.
+	silenceRing(fileFormat.ringStart - RESAMPLE_REACH * fileFormat.bytesPerSample * fileFormat.channels);
+
+	// update() only reads the slot for the newest epoch, which can't be this one.
+	streamFormats[epoch & 1] = fileFormat;
+
+	__sync_synchronize();
+	writeState = (epoch << RING_EPOCH_SHIFT) | fileFormat.ringStart;
+}
+
+bool SDPlayPCM::skipTo(uint32_t dataPosition) {
+	if(!rawfile && !openPending) return false;
+	// Another player may have taken the ring since this one stopped
+	if (ringSize == 0 && !allocateRing(fileInfo)) return false;
+	// A read still on its way in could land on the silence startStream() puts before the start
+	waitIdle();
+	// Start on a whole frame so the channels don't swap over
+	uint32_t frameBytes = fileFormat.bytesPerSample * fileFormat.channels;
+	dataPosition -= dataPosition % frameBytes;
+	bytesLeftInFile = dataSize - dataPosition;
+	fileFormat.startFrame = dataPosition / frameBytes;
+	// Start the stream as far into the ring as it is into a sector of the file. Then
+	// the ring's end is on a sector boundary and after the first read prefetch() reads
+	// whole sectors. It has to be on a frame too, which some header sizes don't allow.
+	uint32_t ringStart = (dataOffset + dataPosition) % SD_SECTOR;
+	for (uint8_t i = 0; i < frameBytes && ringStart % frameBytes != 0; i++) {
+		ringStart += SD_SECTOR;
+	}
+	if (fileFormat.ringSize % SD_SECTOR != 0 || ringStart % frameBytes != 0 || ringStart >= (uint32_t) fileFormat.ringSize) {
+		ringStart = 0;
+	}
+	fileFormat.ringStart = ringStart;
+	ringFollowsFile = true;
+	// Seek when prefetch() first needs the card
+	seekPending = true;
+	if (cache != NULL) {
+		const unsigned char* cached;
+		if (cache->find(fileInfo, dataPosition, &cached) > 0) {
+			cache->hits++;
+		} else {
+			cache->misses++;
+		}
+	}
+	M(startMicros = micros(););
+	startStream();
+	playing = true;
+	return true;
+}
+
+// Open the file and seek to where prefetch() has got to, if they've been put off.
+bool SDPlayPCM::openFile() {
+	if (openPending) {
+		openPending = false;
+		rawfile = SD.open(filename);
+		if (!rawfile) {
+			D(
+				debugHeader();
+				Serial.print("!!! Can't open ");
+				Serial.println(filename);
+			);
+			return false;
+		}
+	}
+	if (seekPending) {
+		seekPending = false;
+		boolean didseek = rawfile.seek(dataOffset + dataSize - bytesLeftInFile);
+		if(!didseek) {
+			D(
+				debugHeader();
+				Serial.println("!!! didseek is false");
+			);
+		}
+	}
 	return true;
 }
 
 bool SDPlayPCM::playFrom(AudioFileInfo* info) {
 
-	uint32_t pos = info->dataOffset + info->startPlayFrom;
+	noRingRoom = false;
 
 	D(
 		debugHeader();
 		Serial.print("Play ");
-		Serial.print(info->name);
+		Serial.print(info->getName());
 		Serial.print(" from ");
 		Serial.print(info->startPlayFrom);
 		Serial.print(" starting from ");
-		Serial.println(pos);
+		Serial.println(info->dataOffset + info->startPlayFrom);
 	);
 
 
 	// We use the same file, just seek inside it.
-	if (info->name.compareTo(filename) == 0) {
+	if (strcmp(info->getName(), filename) == 0) {
 		D(
 			debugHeader();
 			Serial.print("Continuing on file ");
@@ -167,6 +353,7 @@ bool SDPlayPCM::playFrom(AudioFileInfo* info) {
 			Serial.println(rawfile.size());
 		);
 
+		fileInfo = info;
 		updateRequired = false;
 		return skipTo(info->startPlayFrom);
 
@@ -177,10 +364,6 @@ bool SDPlayPCM::playFrom(AudioFileInfo* info) {
 		);
 	}
 
-	//if(playing) stop();
-
-//	if(!playing) AudioStartUsingSPI();
-
 	if (!changeFileTo(info, true)) {
 		updateRequired = false;
 		return false;
@@ -194,23 +377,9 @@ bool SDPlayPCM::playFrom(AudioFileInfo* info) {
 
 	skipTo(info->startPlayFrom);
 
-//	__disable_irq()
-//	;
-//	if(!rawfile.seek(pos)) {
-//		debugHeader();
-//		Serial.println("Seek failed");
-//	}
-//	bytesLeftInFile = info->size - info->startPlayFrom;
-//	playing = true;
-//	finished = false;
-//	__enable_irq()
-//	;
-
 	D(
 		debugHeader();
-		Serial.print("Open. RPIB ");
-		Serial.print(readPositionInBytes);
-		Serial.print(" .InfoSize ");
+		Serial.print("Open. InfoSize ");
 		Serial.print(info->size);
 		Serial.print(" .BLIF ");
 		Serial.print(bytesLeftInFile);
@@ -231,580 +400,802 @@ void SDPlayPCM::restart() {
 		debugHeader();
 		Serial.println("Restart");
 	);
-	__disable_irq()
-	;
-	rawfile.seek(dataOffset);
-	bytesLeftInFile = dataSize;
-	playing = true;
-	finished = false;
-	__enable_irq()
-	;
+	skipTo(0);
 }
 
 void SDPlayPCM::stop(void) {
-	__disable_irq()
-	;
 	D(
 		debugHeader();
 		Serial.println("Stop");
 	);
-	if (playing) {
-		playing = false;
-		__enable_irq()
-		;
-//		AudioStopUsingSPI();
-	} else {
-		__enable_irq()
-		;
-	}
+	playing = false;
 }
 
-void SDPlayPCM::update(void) {
+// Called from loop(). Keeps the ring buffer topped up so update() never touches the SD card.
+// Only this writes to the ring and writeState, only update() writes readState.
+void SDPlayPCM::prefetch() {
+	if ((!rawfile && !openPending) || ringSize == 0) return;
 
-	uint16_t n = AUDIO_BLOCK_SAMPLES;
-	audio_block_t *block;
-	uint16_t i = 0;
+	// Nothing more until the read that's on its way is all in
+	if (readPending) {
+		if (!readDone) return;
+		finishRead();
+	}
 
-	if(errors > 100) return;
+	uint32_t state = writeState;
+	if (state & RING_END_OF_DATA) return;
 
-	// only update if we're playing
-	if (!playing)
-		return;
+	uint32_t epoch = RING_EPOCH(state);
+	uint32_t writePos = RING_POS(state);
 
-	if(!looping) {
-		if(finished || bytesLeftInFile == 0) {
-			D(
+	// If update() hasn't picked up the current stream yet it will start reading from its start.
+	uint32_t read = readState;
+	uint32_t readPos = RING_EPOCH(read) == epoch ? RING_POS(read) : fileFormat.ringStart;
+
+	unsigned char* ring = fileFormat.ring;
+	int32_t ringSize = fileFormat.ringSize;
+	int32_t used = writePos - readPos;
+	if (used < 0) used += ringSize;
+	int32_t space = ringSize - RING_HISTORY - used;
+
+	// Don't bother with small reads unless that's all that's left of the file.
+	if (space < PREFETCH_MIN_READ && space < bytesLeftInFile) return;
+
+	uint32_t endOfData = 0;
+	while (space > 0) {
+		if (bytesLeftInFile <= 0) {
+			if (looping) {
+				// The start is usually cached so only seek if it's needed
+				bytesLeftInFile = dataSize;
+				seekPending = true;
+				ringFollowsFile = false;
+			} else {
+				// Silence after the end for interpolation to read. There's always room
+				// for it when update() is waiting on what's left of the file.
+				if (space < RESAMPLE_REACH * fileFormat.bytesPerSample * fileFormat.channels) break;
+				silenceRing(writePos);
+				endOfData = RING_END_OF_DATA;
+				break;
+			}
+		}
+
+		// Read up to the end of the ring, or the file, whichever comes first
+		int32_t length = ringSize - writePos;
+		if (length > space) length = space;
+		if (length > bytesLeftInFile) length = bytesLeftInFile;
+
+		// Take what we can from the cache. The card is only needed once we're past it.
+		const unsigned char* cached;
+		int32_t got = cache != NULL ? cache->find(fileInfo, dataSize - bytesLeftInFile, &cached) : 0;
+		if (got > 0) {
+			if (got > length) got = length;
+			memcpy(&ring[writePos], cached, got);
+			seekPending = true;
+		} else {
+			// End on a sector boundary unless it's the end of the file. If there's only
+			// room for part of a sector, wait for more, unless it's up to the end of the ring.
+			uint32_t filePosition = dataOffset + dataSize - bytesLeftInFile;
+			int32_t partial = (filePosition + length) % SD_SECTOR;
+			if (length < bytesLeftInFile && partial > 0) {
+				if (partial < length) {
+					length -= partial;
+				} else if (length == space) {
+					break;
+				}
+			}
+			if (firstSector != 0) {
+				// DMA brings the sectors in and a later prefetch() counts them in.
+				// Reads that don't start on a sector start on the one before, rewriting what's
+				// behind writePos. That's the same part of the file, or nothing yet for a new stream.
+				uint32_t lead = filePosition % SD_SECTOR;
+				unsigned char* data = &ring[writePos - lead];
+				uint16_t sectors = (lead + length) / SD_SECTOR;
+				readBounced = (lead != 0 && (!ringFollowsFile || lead > writePos)) || (lead + length) % SD_SECTOR != 0;
+				if (readBounced) {
+					// Otherwise one sector at a time through sectorBuffer. Only at the end of
+					// the ring or the file, or just after looping.
+					if (length > (int32_t) (SD_SECTOR - lead)) length = SD_SECTOR - lead;
+					data = sectorBuffer;
+					sectors = 1;
+				}
+				if (reader->read(firstSector + filePosition / SD_SECTOR, sectors, data, readComplete, this)) {
+					readPending = true;
+					readDone = false;
+					readEpoch = epoch;
+					readPosition = writePos;
+					readLead = lead;
+					readLength = length;
+					// The file hasn't moved on
+					seekPending = true;
+				}
+				return;
+			}
+			// The SD library has to wait for DMA reads to finish
+			if (reader != NULL && !reader->idle()) break;
+			if (!openFile()) {
+				// Nothing more will come. Stop once what's in the ring has played.
+				endOfData = RING_END_OF_DATA;
+				break;
+			}
+			got = rawfile.read(&ring[writePos], length);
+			// Sometimes we get a read error here, but it might be due to long wires on the prototype board. Trying again often works.
+			if (got <= 0) got = rawfile.read(&ring[writePos], length);
+		}
+		if (got <= 0) {
+			B(
 				debugHeader();
-				Serial.println("File finished");
+				Serial.print("Read error. BLIF ");
+				Serial.print(bytesLeftInFile);
+				Serial.print("\t File avail ");
+				Serial.println(fileAvailable());
 			);
-			playing = false;
-			finished = true;
-			return;
+			errors++;
+			break;
 		}
+
+		bytesLeftInFile -= got;
+		space -= got;
+		ringFollowsFile = true;
+		writePos += got;
+		if (writePos >= (uint32_t) ringSize) writePos = 0;
+		bufferFills++;
+
+		// Publish each read so update() can use it straight away
+		__sync_synchronize();
+		writeState = (epoch << RING_EPOCH_SHIFT) | writePos;
 	}
 
-	// allocate the audio blocks to transmit
-	block = allocate();
-	if (block == NULL)
-		return;
+	if (endOfData) {
+		writeState = (epoch << RING_EPOCH_SHIFT) | endOfData | writePos;
+	}
+}
 
-	inUpdate = true;
-	//read = 0;
-	speed = playbackSpeed * sampleRateSpeed;
-	bytesRequired = ceil(AUDIO_BLOCK_SAMPLES * speed) * bytesPerSample * channels; // ceil returns the smallest integer value not less than x (e.g. ceil(1.6)=2	)
+void SDPlayPCM::waitIdle() {
+	while (readPending && !readDone) reader->poll();
+}
 
-	if (bytesRequired > AUDIOBUFSIZE) {
-		bytesRequired = AUDIOBUFSIZE;
-		D(
+// Count in a read that DMA has finished, unless a new stream has started since.
+void SDPlayPCM::finishRead() {
+	readPending = false;
+	uint32_t state = writeState;
+	if (RING_EPOCH(state) != readEpoch) return;
+	if (!readOk) {
+		B(
 			debugHeader();
-			Serial.println("!!! Bytes Required is bigger than the audio buffer..");
+			Serial.print("DMA read error. BLIF ");
+			Serial.println(bytesLeftInFile);
 		);
+		errors++;
+		return;
+	}
+	if (readBounced) {
+		memcpy(&fileFormat.ring[readPosition], &sectorBuffer[readLead], readLength);
 	}
+	bytesLeftInFile -= readLength;
+	ringFollowsFile = true;
+	uint32_t writePos = readPosition + readLength;
+	if (writePos >= (uint32_t) fileFormat.ringSize) writePos = 0;
+	bufferFills++;
+	__sync_synchronize();
+	writeState = (readEpoch << RING_EPOCH_SHIFT) | writePos;
+}
 
-	if (bytesAvailable < bytesRequired) {
+// Called by the reader, from loop()
+void SDPlayPCM::readComplete(void* context, bool ok) {
+	SDPlayPCM* player = (SDPlayPCM*) context;
+	player->readOk = ok;
+	player->readDone = true;
+}
 
-		bool bufferReadOk = false;
-		if (bytesRequired
-				< AUDIO_BLOCK_SAMPLES * bytesPerSample * channels) {
-			bufferReadOk = fillBuffer(AUDIO_BLOCK_SAMPLES * bytesPerSample * channels);
-		} else {
-			bufferReadOk = fillBuffer(bytesRequired);
-		}
-		if (readError || !bufferReadOk) {
-			D(Serial.print("Read error. ");
-			  Serial.println(errors);
-			  );
-			errors++;
-			readError = false;
-			// Fill block with zero.
-			for (i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
-				block->data[i] = 0;
-			}
-			transmit(block);
-			release(block);
-			updates++;
-			return;
-		}
+static inline int16_t saturate16(int32_t value) {
+	if (value > 32767) return 32767;
+	if (value < -32768) return -32768;
+	return value;
+}
 
+static inline int16_t floatTo16(float value) {
+	if (value >= 1.0f) return 32767;
+	if (value > -1.0f) return value * 32768.0f;
+	if (value <= -1.0f) return -32768;
+	// NaN
+	return 0;
+}
+
+static inline float floatAt(const unsigned char* p) {
+	float value;
+	memcpy(&value, p, 4);
+	return value;
+}
+
+static inline int32_t int32At(const unsigned char* p) {
+	int32_t value;
+	memcpy(&value, p, 4);
+	return value;
+}
+
+// One sample as 16 bit
+template<int TYPE>
+static inline int32_t sample16(const unsigned char* p) {
+	if (TYPE == SAMPLE_UINT8) {
+		// 8 bit WAV is unsigned, 128 is silence. Scaled by multiplying, a left
+		// shift of a negative value is undefined.
+		return (p[0] - 128) * 256;
+	} else if (TYPE == SAMPLE_INT16) {
+		int16_t value;
+		memcpy(&value, p, 2);
+		return value;
+	} else if (TYPE == SAMPLE_INT24) {
+		// Top 16 bits of a 24 bit sample, in one unaligned halfword load
+		int16_t value;
+		memcpy(&value, p + 1, 2);
+		return value;
+	} else if (TYPE == SAMPLE_INT32) {
+		int16_t value;
+		memcpy(&value, p + 2, 2);
+		return value;
 	}
+	return floatTo16(floatAt(p));
+}
 
-	int16_t* out = block->data;
+// Both channels of a stereo frame averaged to 16 bit. They're summed at full
+// resolution then the low bits dropped, so neither channel is rounded first.
+template<int TYPE>
+static inline int32_t mixed16(const unsigned char* p) {
+	if (TYPE == SAMPLE_UINT8) {
+		return (p[0] + p[1] - 256) * 128;
+	} else if (TYPE == SAMPLE_INT16) {
+		return (sample16<SAMPLE_INT16>(p) + sample16<SAMPLE_INT16>(p + 2)) >> 1;
+	} else if (TYPE == SAMPLE_INT24) {
+		// Word loads that stay inside the frame. The left sample is the low 3 bytes
+		// of the first, the right the high 3 bytes of the second.
+		int32_t left = (uint32_t) int32At(p) << 8;
+		int32_t right = int32At(p + 2);
+		return ((left >> 8) + (right >> 8)) >> 9;
+	} else if (TYPE == SAMPLE_INT32) {
+		// Halve first so the sum can't overflow
+		return ((int32At(p) >> 1) + (int32At(p + 4) >> 1)) >> 16;
+	}
+	return floatTo16((floatAt(p) + floatAt(p + 4)) * 0.5f);
+}
 
-	l0 = 0;
-	lowSamplePos = 0;
-	float sp = speed * channels;
+// Read one sample from the ring buffer as 16 bit.
+// With WRAP pos may be up to one buffer length either side of the buffer,
+// otherwise it must be inside it.
+// With MIX both channels of the frame at pos are averaged.
+template<int TYPE, bool MIX, bool WRAP>
+static inline int32_t sampleAt(const unsigned char* buffer, int32_t size, int32_t pos) {
+	if (WRAP) {
+		if (pos >= size) pos -= size;
+		else if (pos < 0) pos += size;
+	}
+	if (MIX) {
+		return mixed16<TYPE>(&buffer[pos]);
+	}
+	return sample16<TYPE>(&buffer[pos]);
+}
 
-	// Check for buffer wrapping here so we don't do it 128 times in the loop.
-	boolean bufferWrap = ((n*sp) * bytesPerSample) + readPositionInBytes >= AUDIOBUFSIZE;
-	if (bytesPerSample == 2) {
-		// 16 bit copy
-		if(bufferWrap) {
-			for (i = 0; i < n; i++) {
-				lowSamplePos = (i * speed);
-				l0 = readPositionInBytes + (lowSamplePos << channels);
-				if (l0 >= AUDIOBUFSIZE) l0 -= AUDIOBUFSIZE;
-				memcpy(out++, &audioBuffer[l0],2);
-			}
+// Unpack 24 bit samples to 16 bit. Each 3 aligned word loads hold 4 samples,
+// 4 mono frames or 2 stereo ones. Left gets the first of each frame, right the second.
+// src must be word aligned and frames a whole number of groups of 3 words.
+template<int CHANNELS>
+static inline void unpack24(const unsigned char* src, int16_t* left, int16_t* right, uint16_t frames) {
+	const uint32_t* words = (const uint32_t*) src;
+	for (uint16_t i = 0; i < frames; i += 4 / CHANNELS) {
+		uint32_t w0 = *words++;
+		uint32_t w1 = *words++;
+		uint32_t w2 = *words++;
+		// Top 2 bytes of each sample
+		int16_t s0 = w0 >> 8;
+		int16_t s1 = w1;
+		int16_t s2 = (w1 >> 24) | (w2 << 8);
+		int16_t s3 = w2 >> 16;
+		if (CHANNELS == 1) {
+			*left++ = s0;
+			*left++ = s1;
+			*left++ = s2;
+			*left++ = s3;
 		} else {
-			// We won't wrap the buffer edge so don't check
-			for (i = 0; i < n; i++) {
-				lowSamplePos = (i * speed);
-				l0 = readPositionInBytes + (lowSamplePos << channels);
-				memcpy(out++, &audioBuffer[l0],2);
+			*left++ = s0;
+			*left++ = s2;
+			if (right != NULL) {
+				*right++ = s1;
+				*right++ = s3;
 			}
 		}
-	} else if (bytesPerSample == 3) {
-
-		if(channels == 1) {
-			if(bufferWrap) {
-				// 24 bit copy.
-				for (i = 0; i < n; i++) {
-					lowSamplePos = (i * speed);
-					l0 = readPositionInBytes + (lowSamplePos * 3);
-					if (l0 >= AUDIOBUFSIZE) l0 -= AUDIOBUFSIZE;
-					*out++ = (audioBuffer[l0] | (audioBuffer[++l0] << 8) | (audioBuffer[++l0] << 16)) >> 8;
-				}
-			} else {
-				// 24 bit copy.
-				for (i = 0; i < n; i++) {
-					lowSamplePos = (i * speed);
-					l0 = readPositionInBytes + (lowSamplePos * 3);
-					*out++ = (audioBuffer[l0] | (audioBuffer[++l0] << 8) | (audioBuffer[++l0] << 16)) >> 8;
+	}
+}
+
+// Average the right block into the left one. Halving the sum gives the
+// headroom, so loud material panned centre can't clip.
+static void downmix(int16_t* left, const int16_t* right) {
+#if defined(__ARM_ARCH_7EM__)
+	// Two samples per instruction. Audio block data is word aligned.
+	uint32_t* l = (uint32_t*) left;
+	const uint32_t* r = (const uint32_t*) right;
+	for (int i = 0; i < AUDIO_BLOCK_SAMPLES / 2; i++) {
+		l[i] = __SHADD16(l[i], r[i]);
+	}
+#else
+	for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+		left[i] = (left[i] + right[i]) >> 1;
+	}
+#endif
+}
+
+// Polyphase windowed sinc coefficients in Q14, SINC_TAPS taps for each of SINC_PHASES fractional positions.
+// Tap j is applied to the sample at frame offset j - (SINC_TAPS / 2 - 1).
+int16_t SDPlayPCM::sincTable[SINC_PHASES][SINC_TAPS];
+float SDPlayPCM::resampleKernel[RESAMPLE_ZEROS * RESAMPLE_KERNEL_RES + 2];
+bool SDPlayPCM::sincTableReady = false;
+
+void SDPlayPCM::buildSincTable() {
+	if (sincTableReady) return;
+	const float halfWidth = SINC_TAPS / 2;
+	for (int p = 0; p < SINC_PHASES; p++) {
+		float fraction = (float) p / SINC_PHASES;
+		float taps[SINC_TAPS];
+		float sum = 0;
+		for (int j = 0; j < SINC_TAPS; j++) {
+			float x = (j - (SINC_TAPS / 2 - 1)) - fraction;
+			float sinc = x == 0 ? 1.0 : sinf(PI * x) / (PI * x);
+			// Blackman window across the kernel
+			float window = 0.42 + 0.5 * cosf(PI * x / halfWidth) + 0.08 * cosf(2 * PI * x / halfWidth);
+			taps[j] = sinc * window;
+			sum += taps[j];
+		}
+		// Normalise so each phase has unity gain at DC
+		for (int j = 0; j < SINC_TAPS; j++) {
+			sincTable[p][j] = round(taps[j] * 16384 / sum);
+		}
+	}
+	// A longer kernel finely sampled, for stretching. The window is zero at the last point.
+	const int points = RESAMPLE_ZEROS * RESAMPLE_KERNEL_RES;
+	for (int i = 0; i < points; i++) {
+		float x = (float) i / RESAMPLE_KERNEL_RES;
+		float sinc = x == 0 ? 1.0 : sinf(PI * x) / (PI * x);
+		float window = 0.42 + 0.5 * cosf(PI * x / RESAMPLE_ZEROS) + 0.08 * cosf(2 * PI * x / RESAMPLE_ZEROS);
+		resampleKernel[i] = sinc * window;
+	}
+	resampleKernel[points] = 0;
+	resampleKernel[points + 1] = 0;
+	sincTableReady = true;
+}
+
+// The decode kernel. Decodes n samples of one channel into out, from the current phase.
+// channelOffset is the byte offset of the channel's sample within a frame.
+// Everything that's fixed for a stream is a template parameter so the loops
+// are built for it. WRAP kernels handle reads past the edges of the ring buffer,
+// the others are only used when a block doesn't get near them.
+template<int TYPE, int CHANNELS, int MODE, bool WRAP, bool MIX>
+void SDPlayPCM::decode(int16_t* out, uint16_t n, int32_t channelOffset) {
+	const int32_t frameBytes = SAMPLE_BYTES(TYPE) * CHANNELS;
+	// Locals so the compiler knows writing to out doesn't change them
+	const unsigned char* buffer = audioBuffer;
+	const int32_t size = bufferSize;
+	const uint64_t increment = phaseIncrement;
+	int32_t start = readPositionInBytes + channelOffset;
+	uint64_t phase = phaseFraction;
+	uint16_t i;
+
+	if (MODE == INTERPOLATION_NONE) {
+		for (i = 0; i < n; i++) {
+			*out++ = sampleAt<TYPE, MIX, WRAP>(buffer, size, start + (int32_t) (phase >> 32) * frameBytes);
+			phase += increment;
+		}
+	} else if (MODE == INTERPOLATION_LINEAR) {
+		for (i = 0; i < n; i++) {
+			int32_t pos = start + (int32_t) (phase >> 32) * frameBytes;
+			int32_t s0 = sampleAt<TYPE, MIX, WRAP>(buffer, size, pos);
+			int32_t s1 = sampleAt<TYPE, MIX, WRAP>(buffer, size, pos + frameBytes);
+			// 15 bit fraction so the product can't overflow
+			int32_t t = (uint32_t) phase >> 17;
+			*out++ = s0 + (((s1 - s0) * t) >> 15);
+			phase += increment;
+		}
+	} else if (MODE == INTERPOLATION_HERMITE) {
+		// 4 point, 3rd order Hermite (Catmull-Rom)
+		for (i = 0; i < n; i++) {
+			int32_t pos = start + (int32_t) (phase >> 32) * frameBytes;
+			float sm1 = sampleAt<TYPE, MIX, WRAP>(buffer, size, pos - frameBytes);
+			float s0 = sampleAt<TYPE, MIX, WRAP>(buffer, size, pos);
+			float s1 = sampleAt<TYPE, MIX, WRAP>(buffer, size, pos + frameBytes);
+			float s2 = sampleAt<TYPE, MIX, WRAP>(buffer, size, pos + 2 * frameBytes);
+			float t = (uint32_t) phase * (1.0f / 4294967296.0f);
+			float c1 = 0.5f * (s1 - sm1);
+			float c2 = sm1 - 2.5f * s0 + 2.0f * s1 - 0.5f * s2;
+			float c3 = 0.5f * (s2 - sm1) + 1.5f * (s0 - s1);
+			*out++ = saturate16(((c3 * t + c2) * t + c1) * t + s0);
+			phase += increment;
+		}
+	} else if (MODE == KERNEL_RESAMPLE) {
+		// Windowed sinc, stretched to filter out anything that would alias at this speed.
+		// The kernel is read from resampleKernel with linear interpolation, and
+		// normalised by its sum for unity gain at any stretch.
+		const float scale = resampleScale * RESAMPLE_KERNEL_RES;
+		const float limit = RESAMPLE_ZEROS * RESAMPLE_KERNEL_RES;
+		const int32_t reach = resampleReach;
+		for (i = 0; i < n; i++) {
+			int32_t pos = start + ((int32_t) (phase >> 32) + 1 - reach) * frameBytes;
+			float t = (uint32_t) phase * (1.0f / 4294967296.0f);
+			float sum = 0;
+			float weight = 0;
+			for (int32_t k = 1 - reach; k <= reach; k++) {
+				float x = fabsf(k - t) * scale;
+				if (x < limit) {
+					int32_t index = x;
+					float h = resampleKernel[index] + (resampleKernel[index + 1] - resampleKernel[index]) * (x - index);
+					sum += sampleAt<TYPE, MIX, WRAP>(buffer, size, pos) * h;
+					weight += h;
 				}
+				pos += frameBytes;
 			}
-		} else {
-			if(bufferWrap) {
-				// 24 bit copy.
-				for (i = 0; i < n; i++) {
-					lowSamplePos = (i * speed);
-					l0 = readPositionInBytes + ((lowSamplePos * 3) << 1);
-					if (l0 >= AUDIOBUFSIZE) l0 -= AUDIOBUFSIZE;
-					*out++ = (audioBuffer[l0] | (audioBuffer[++l0] << 8) | (audioBuffer[++l0] << 16)) >> 8;
-				}
-			} else {
-				// 24 bit copy.
-				for (i = 0; i < n; i++) {
-					lowSamplePos = (i * speed);
-					l0 = readPositionInBytes + ((lowSamplePos * 3) << 1);
-					*out++ = (audioBuffer[l0] | (audioBuffer[++l0] << 8) | (audioBuffer[++l0] << 16)) >> 8;
-				}
+			*out++ = saturate16(sum / weight);
+			phase += increment;
+		}
+	} else {
+		// Windowed sinc. Nearest of SINC_PHASES coefficient sets.
+		const int32_t first = -(SINC_TAPS / 2 - 1) * frameBytes;
+		for (i = 0; i < n; i++) {
+			int32_t pos = start + (int32_t) (phase >> 32) * frameBytes + first;
+			const int16_t* taps = sincTable[(uint32_t) phase >> (32 - SINC_PHASE_BITS)];
+			int32_t sum = 0;
+			for (int j = 0; j < SINC_TAPS; j++) {
+				sum += sampleAt<TYPE, MIX, WRAP>(buffer, size, pos) * taps[j];
+				pos += frameBytes;
 			}
-
+			*out++ = saturate16(sum >> 14);
+			phase += increment;
 		}
 	}
+}
 
-	if (n != AUDIO_BLOCK_SAMPLES) {
-		B(
-			debugHeader();
-			Serial.print("n != BLOCK : ");
-			Serial.println(n);
-		);
-
-		// There wasn't enough data earlier to fill the audio block
+// All the kernels for one stream format, indexed by [mode * 2 + wrap]
+template<int TYPE, int CHANNELS, bool MIX>
+const SDPlayPCM::DecodeKernel* SDPlayPCM::kernelsFor() {
+	static const DecodeKernel kernels[KERNEL_MODES * 2] = {
+		&SDPlayPCM::decode<TYPE, CHANNELS, INTERPOLATION_NONE, false, MIX>,
+		&SDPlayPCM::decode<TYPE, CHANNELS, INTERPOLATION_NONE, true, MIX>,
+		&SDPlayPCM::decode<TYPE, CHANNELS, INTERPOLATION_LINEAR, false, MIX>,
+		&SDPlayPCM::decode<TYPE, CHANNELS, INTERPOLATION_LINEAR, true, MIX>,
+		&SDPlayPCM::decode<TYPE, CHANNELS, INTERPOLATION_HERMITE, false, MIX>,
+		&SDPlayPCM::decode<TYPE, CHANNELS, INTERPOLATION_HERMITE, true, MIX>,
+		&SDPlayPCM::decode<TYPE, CHANNELS, INTERPOLATION_SINC, false, MIX>,
+		&SDPlayPCM::decode<TYPE, CHANNELS, INTERPOLATION_SINC, true, MIX>,
+		&SDPlayPCM::decode<TYPE, CHANNELS, KERNEL_RESAMPLE, false, MIX>,
+		&SDPlayPCM::decode<TYPE, CHANNELS, KERNEL_RESAMPLE, true, MIX>,
+	};
+	return kernels;
+}
 
-		bytesUsed = (n * sp) * bytesPerSample;
-		// Fill rest of block with zeros.
-		for (i = n; i < AUDIO_BLOCK_SAMPLES; i++) {
-			*out++ = 0;
+// Pick the kernels for a file format. With mix, the ones that mix stereo to mono.
+// 16 bit stereo has no mix kernels, update() mixes the decoded channels instead.
+const SDPlayPCM::DecodeKernel* SDPlayPCM::selectKernels(uint8_t sampleType, uint8_t channels, bool mix) {
+	if (mix) {
+		switch (sampleType) {
+			case SAMPLE_UINT8: return kernelsFor<SAMPLE_UINT8, 2, true>();
+			case SAMPLE_INT24: return kernelsFor<SAMPLE_INT24, 2, true>();
+			case SAMPLE_INT32: return kernelsFor<SAMPLE_INT32, 2, true>();
+			case SAMPLE_FLOAT32: return kernelsFor<SAMPLE_FLOAT32, 2, true>();
+		}
+		return NULL;
+	}
+	if (channels == 2) {
+		switch (sampleType) {
+			case SAMPLE_UINT8: return kernelsFor<SAMPLE_UINT8, 2, false>();
+			case SAMPLE_INT16: return kernelsFor<SAMPLE_INT16, 2, false>();
+			case SAMPLE_INT24: return kernelsFor<SAMPLE_INT24, 2, false>();
+			case SAMPLE_INT32: return kernelsFor<SAMPLE_INT32, 2, false>();
+			case SAMPLE_FLOAT32: return kernelsFor<SAMPLE_FLOAT32, 2, false>();
 		}
-		if (!looping)
-			finished = true;
 	} else {
-		bytesUsed = bytesRequired;
+		switch (sampleType) {
+			case SAMPLE_UINT8: return kernelsFor<SAMPLE_UINT8, 1, false>();
+			case SAMPLE_INT16: return kernelsFor<SAMPLE_INT16, 1, false>();
+			case SAMPLE_INT24: return kernelsFor<SAMPLE_INT24, 1, false>();
+			case SAMPLE_INT32: return kernelsFor<SAMPLE_INT32, 1, false>();
+			case SAMPLE_FLOAT32: return kernelsFor<SAMPLE_FLOAT32, 1, false>();
+		}
 	}
-
-	readPositionInBytes += bytesUsed;
-	readPositionInBytes %= AUDIOBUFSIZE;
-
-	bytesAvailable -= bytesUsed;
-
-
-	transmit(block);
-	release(block);
-	inUpdate = false;
-	updates++;
-	if(readError) errors++;
-	readError = false;
+	return NULL;
 }
 
-bool SDPlayPCM::fillBuffer(int32_t requiredBytes) {
-
-// How many bytes until the end of the buffer
-	spaceLeftInBuffer = AUDIOBUFSIZE - bufferFillPosition;
+// 24 bit at unity speed. Unpacks whole words at a time from the ring into
+// the left block and, for stereo, the right one if it isn't NULL.
+void SDPlayPCM::copyUnity24(int16_t* left, int16_t* right, uint16_t n) {
+	const int32_t frameBytes = 3 * channels;
+	// Frames per 3 words
+	const uint16_t group = 4 / channels;
+	int32_t pos = readPositionInBytes;
+	uint16_t i = 0;
+	while (i < n) {
+		// Up to the end of the ring, then carry on from the start
+		if (pos >= bufferSize) pos -= bufferSize;
+		uint16_t frames = (bufferSize - pos) / frameBytes;
+		if (frames > n - i) frames = n - i;
+		uint16_t end = i + frames;
+		const unsigned char* p = &audioBuffer[pos];
+		// A sample at a time until we get to a word boundary
+		while (i < end && ((uintptr_t) p & 3) != 0) {
+			left[i] = sample16<SAMPLE_INT24>(p);
+			if (right != NULL) right[i] = sample16<SAMPLE_INT24>(p + 3);
+			p += frameBytes;
+			i++;
+		}
+		uint16_t words = (end - i) / group * group;
+		if (channels == 1) {
+			unpack24<1>(p, &left[i], NULL, words);
+		} else {
+			unpack24<2>(p, &left[i], right != NULL ? &right[i] : NULL, words);
+		}
+		p += words * frameBytes;
+		i += words;
+		while (i < end) {
+			left[i] = sample16<SAMPLE_INT24>(p);
+			if (right != NULL) right[i] = sample16<SAMPLE_INT24>(p + 3);
+			p += frameBytes;
+			i++;
+		}
+		pos += frames * frameBytes;
+	}
+}
 
-	read = 0;
+void SDPlayPCM::update(void) {
 
-	int32_t read2 = 0;
+	uint16_t n = AUDIO_BLOCK_SAMPLES;
+	audio_block_t *block;
+	uint16_t i = 0;
 
-	B(
-		bool seekRequired = false;
-		int seek = 0;
-		int fillStyle = 0;
+	if(errors > 100) return;
 
-		uint32_t avail = fileAvailable();
+	uint32_t state = writeState;
+	if (RING_EPOCH(state) != RING_EPOCH(readState)) {
+		// prefetch() has started a new stream. Drop whatever was left of the old one.
+		const StreamFormat& next = streamFormats[RING_EPOCH(state) & 1];
+		bytesPerSample = next.bytesPerSample;
+		kernels = next.kernels;
+		mixKernels = next.mixKernels;
+		channels = next.channels;
+		sampleRateSpeed = next.sampleRateSpeed;
+		audioBuffer = next.ring;
+		bufferSize = next.ringSize;
+		streamFrames = next.frames;
+		readPositionInBytes = next.ringStart;
+		phaseFraction = 0;
+		playPosition = (uint64_t) next.startFrame << 32;
+		starting = true;
+		finished = false;
+		readState = (RING_EPOCH(state) << RING_EPOCH_SHIFT) | readPositionInBytes;
+	}
 
-		if(bytesLeftInFile > avail) {
-			debugHeader();
-			Serial.print("BLIF > Available at start. ");
-			Serial.print(bytesLeftInFile);
-			Serial.print(" > ");
-			Serial.println(avail);
-			if(bytesLeftInFile % bytesPerSample != 0) {
-				Serial.println("BLIF not aligned");
-			}
-			if(avail % bytesPerSample != 0) {
-				Serial.println("Available not aligned");
-			} else {
-				bytesLeftInFile = avail;
-			}
-		}
-	);
+	// only update if we're playing
+	if (!playing || bufferSize == 0 || kernels == NULL)
+		return;
 
-	// Is there enough left to read from the file?
-	if (bytesLeftInFile < requiredBytes - bytesAvailable) {
-		B(
+	if(finished) {
+		D(
 			debugHeader();
-			Serial.print("Not enough data in file. ");
-			Serial.print(bytesLeftInFile);
-			Serial.print(" left. \t");
-			Serial.print(bytesRequired);
-			Serial.print(" Reqd\t");
-			Serial.print(bytesAvailable);
-			Serial.print(" avail after ");
-			Serial.print(bufferFills);
-			Serial.print(" fills. Left in buf ");
-			Serial.println(spaceLeftInBuffer);
+			Serial.println("File finished");
 		);
-
-		if (!looping) {
-			// we're not looping and the file will run out
-			// so only attempt to read the rest of the file
-			B(
-				debugHeader();
-				Serial.print("Changing required to ");
-				Serial.println(bytesLeftInFile);
-			);
-			requiredBytes = bytesLeftInFile;
-		} else {
-			B(
-				debugHeader();
-				Serial.println("Seek required during fillBuffer");
-				seekRequired = true;
-				seek = 1;
-			);
-		}
+		playing = false;
+		return;
 	}
 
-	if (requiredBytes > spaceLeftInBuffer) {
-		// If we read all the data we need it will go across the buffer boundary
+	// allocate the audio blocks to transmit
+	block = allocate();
+	if (block == NULL)
+		return;
 
-		if (spaceLeftInBuffer <= bytesLeftInFile) {
-			// Fill to end of buffer
-			read = rawfile.read(&(audioBuffer[bufferFillPosition]),
-					spaceLeftInBuffer);
-			if (read == -1 && !readError) {
-				B(
-					Serial.println("SDP: Read Error 1");
-				);
-				readError = true;
-				goto endfill;
-			}
-			bufferFillPosition = 0;
-
-			if (requiredBytes <= bytesLeftInFile) {
-				B(fillStyle = 1;);
-				// Not enough buffer space, but enough left in file. No seek required
-				// Fill buffer from start
-				if (requiredBytes - read > 0) {
-					read2 = rawfile.read(audioBuffer, requiredBytes - read);
-					if (read2 == -1 && !readError) {
-						readError = true;
-						B(Serial.println("SDP: Read Error 2"););
-						goto endfill;
-					}
-					read += read2;
-					bufferFillPosition = read2;
-				} else {
-					bufferFillPosition = 0;
-				}
-				bytesLeftInFile -= read;
+	inUpdate = true;
+	//read = 0;
+	speed = playbackSpeed * sampleRateSpeed;
+	if (speed != phaseSpeed) {
+		// Only convert to fixed point when the speed actually changes
+		phaseSpeed = speed;
+		phaseIncrement = (uint64_t) (speed * 4294967296.0);
+		float ratio = speed / RESAMPLE_CUTOFF;
+		if (ratio > RESAMPLE_MAX_RATIO) ratio = RESAMPLE_MAX_RATIO;
+		resampleScale = speed > 1.0 ? 1.0 / ratio : 1.0;
+		resampleReach = ceil(RESAMPLE_ZEROS * ratio);
+		// Land on whole frames at unity speed so the straight copy can be used.
+		// This is what drop sample plays anyway.
+		if (phaseIncrement == (1ULL << 32)) phaseFraction = 0;
+	}
 
-			} else {
-				// There is enough data in the file to fill the end of the buffer
-				// BUT NOT enough in the file to get all the data we need. Seek is required
-
-				// We've already filled to the end of the buffer
-
-				// now fill from start of buffer with what's left in the file
-				if (bytesLeftInFile - read > 0) {
-					read2 = rawfile.read(audioBuffer, bytesLeftInFile - read);
-					if (read2 == -1 && !readError) {
-						B(
-							Serial.println("SDP: Read Error 3");
-						);
-						readError = true;
-						goto endfill;
-					}
-					read += read2;
-					bufferFillPosition = read2;
-				}
+	// Frames after the current one the decoder reads
+	uint8_t mode = interpolation;
+	uint32_t lookahead = INTERPOLATION_LOOKAHEAD[mode];
+	if (mode == INTERPOLATION_SINC && resampleScale < 1.0) {
+		mode = KERNEL_RESAMPLE;
+		lookahead = resampleReach;
+	}
 
-				// Seek to start of file
-				rawfile.seek(dataOffset);
-
-				// get the bit thats left
-				int32_t lastBit = requiredBytes - read;
-				B(
-					fillStyle = 2;
-					seekRequired = true;
-					seek = 0;
-
-					if (lastBit <= 0) {
-						Serial.print("SDP: Last bit not +ve ");
-						Serial.println(lastBit);
-					} else {
-						debugHeader();
-						Serial.print("Last bit ");
-						Serial.println(lastBit);
-					}
-				);
-				int32_t read3 = rawfile.read(&(audioBuffer[bufferFillPosition]),
-						lastBit);
-				if (read3 == -1 && !readError) {
-					B(
-						Serial.println("SDP: Read error 4");
-					);
-					readError = true;
-					goto endfill;
-				}
+	uint16_t frameBytes = bytesPerSample * channels;
+
+	// The last frame this block reads from, and the frame the next block starts on.
+	// framesUsed is the integer part of the phase after a full block, the fractional
+	// part is kept in phaseFraction for the next block.
+	uint64_t endPhase = phaseFraction + phaseIncrement * AUDIO_BLOCK_SAMPLES;
+	uint32_t framesUsed = endPhase >> 32;
+	// Interpolating also reads frames after the last one.
+	uint32_t framesRequired = ((phaseFraction + phaseIncrement * (AUDIO_BLOCK_SAMPLES - 1)) >> 32) + 1 + lookahead;
+	if (framesUsed > framesRequired) framesRequired = framesUsed;
+	bytesRequired = framesRequired * frameBytes;
+	// Furthest the kernel reads, even if the ring can't hold that much
+	int32_t bytesReached = bytesRequired;
+
+	if (bytesRequired > bufferSize - RING_HISTORY) {
+		bytesRequired = bufferSize - RING_HISTORY;
+		D(
+			debugHeader();
+			Serial.println("!!! Bytes Required is bigger than the audio buffer..");
+		);
+	}
 
+	int32_t bytesAvailable = RING_POS(state) - readPositionInBytes;
+	if (bytesAvailable < 0) bytesAvailable += bufferSize;
 
-				read += read3;
-				bytesLeftInFile = dataSize - lastBit;
-				bufferFillPosition += lastBit;
-			}
-		} else {
-			// Buffer has enough space to read the rest of the file.
+	if (bytesAvailable < bytesRequired) {
+
+		if (!(state & RING_END_OF_DATA)) {
+			// prefetch() hasn't kept up. Play silence and wait for it rather than skipping.
 			B(
-				fillStyle = 3;
-				seekRequired = true;
-				seek = 0;
+				debugHeader();
+				Serial.print("Underrun. Avail ");
+				Serial.print(bytesAvailable);
+				Serial.print(" Reqd ");
+				Serial.println(bytesRequired);
 			);
-
-			// Get the rest from the file
-			read = rawfile.read(&(audioBuffer[bufferFillPosition]),
-					bytesLeftInFile);
-			if (read == -1 && !readError) {
-				B(
-					Serial.println("SDP: Read Error 5");
-				);
-				readError = true;
-				goto endfill;
+			underruns++;
+			for (i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+				block->data[i] = 0;
 			}
-			// go to start of file
-			rawfile.seek(dataOffset);
-
-			spaceLeftInBuffer -= read;
-
-			// read to end of buffer
-			read2 = rawfile.read(&(audioBuffer[bufferFillPosition + read]),
-					spaceLeftInBuffer);
-			if (read2 == -1 && !readError) {
-				B(
-					Serial.println("SDP: Read Error 6");
-				);
-				readError = true;
-				goto endfill;
+			transmit(block, 0);
+			transmit(block, 1);
+			release(block);
+			inUpdate = false;
+			updates++;
+			return;
+		} else {
+			// The file ran out. Only output the samples whose frame made it into the buffer.
+			// Interpolation reads the silence prefetch() put after it for the frames past the end.
+			int32_t framesAvailable = bytesAvailable / frameBytes;
+			uint64_t availablePhase = framesAvailable > 0 ? (uint64_t) framesAvailable << 32 : 0;
+			n = 0;
+			if (availablePhase > phaseFraction) {
+				n = (availablePhase - phaseFraction + phaseIncrement - 1) / phaseIncrement;
+				if (n > AUDIO_BLOCK_SAMPLES) n = AUDIO_BLOCK_SAMPLES;
 			}
+		}
 
-			read += read2;
+	}
 
-			// Fill buffer from start with amount that is left
-			int32_t read3 = rawfile.read(audioBuffer, requiredBytes - read);
-			if (read3 == -1 && !readError) {
-				B(
-					Serial.println("SDP: Read Error 7");
-				);
-				readError = true;
-				goto endfill;
-			}
+	M(
+		if (starting) {
+			uint32_t latency = micros() - startMicros;
+			if (latency > startLatencyMax) startLatencyMax = latency;
+		}
+	);
+	starting = false;
+
+	// Stereo files get a second block for the right channel, or to mix it into the left.
+	// Formats with mix kernels are mixed as they're decoded instead.
+	audio_block_t *right = NULL;
+	boolean mixToMono = channels == 2 && stereoMode == STEREO_MODE_MONO;
+	if ((channels == 2 && stereoMode == STEREO_MODE_STEREO) || (mixToMono && mixKernels == NULL)) {
+		// If we're out of blocks just play the left channel.
+		right = allocate();
+	}
 
-			read += read3;
-			bytesLeftInFile = dataSize - (read2 + read3);
-			bufferFillPosition = read3;
+	// Interpolation looks back as far as it looks ahead, at most. If this block's reads
+	// stay clear of the ring's edges use the kernel that doesn't check for them.
+	uint32_t lookbehind = lookahead * frameBytes;
+	boolean bufferWrap = readPositionInBytes < (int32_t) lookbehind || readPositionInBytes + bytesReached > bufferSize;
+	uint8_t kernel = mode * 2 + bufferWrap;
+
+	M(uint32_t cycles = ARM_DWT_CYCCNT;);
+
+	boolean unitySpeed = phaseIncrement == (1ULL << 32) && phaseFraction == 0;
+	if (channels == 1 && bytesPerSample == 2 && unitySpeed) {
+		// 16 bit mono at unity speed is already what the block wants. Copy it
+		// straight out of the ring. Every interpolation mode lands on the sample itself.
+		int32_t bytes = n * 2;
+		int32_t first = bufferSize - readPositionInBytes;
+		if (first > bytes) first = bytes;
+		memcpy(block->data, &audioBuffer[readPositionInBytes], first);
+		if (first < bytes) {
+			memcpy((unsigned char*) block->data + first, audioBuffer, bytes - first);
 		}
+	} else if (bytesPerSample == 3 && unitySpeed && !mixToMono) {
+		copyUnity24(block->data, right != NULL ? right->data : NULL, n);
+	} else if (mixToMono && mixKernels != NULL) {
+		(this->*mixKernels[kernel])(block->data, n, 0);
 	} else {
-
-		// There's enough space in the buffer, is there enough in the file
-		if (bytesLeftInFile >= requiredBytes) {
-//			Serial.println("Fill style 4.");
-			// There's enough data left in the file, just read it
-			read = rawfile.read(&(audioBuffer[bufferFillPosition]), requiredBytes);
-			// Sometimes we get a read error here, but it might be due to long wires on the prototype board. Tring again often works.
-			if (read == -1 && !readError) { read = rawfile.read(&(audioBuffer[bufferFillPosition]), requiredBytes); } // try again
-			if (read == -1 && !readError) { read = rawfile.read(&(audioBuffer[bufferFillPosition]), requiredBytes); } // last time
-			if (read == -1 && !readError) {
-				B(
-					fillStyle = 4;
-					debugHeader();
-					Serial.println("Read Error 8");
-				);
-				readError = true;
-				goto endfill;
-			} else {
-				B(
-					fillStyle = 4;
-					if(read != requiredBytes) {
-						debugHeader();
-						Serial.print("Read != Required. BLIF ");
-						Serial.print(bytesLeftInFile);
-						Serial.print("\t File avail ");
-						Serial.print(fileAvailable());
-						Serial.print("\t File pos ");
-						Serial.println(rawfile.position());
-					}
-				);
-				bytesLeftInFile -= read;
-				bufferFillPosition += read;
-			}
-		} else {
-
-			// Not enough in file
-			read = rawfile.read(&(audioBuffer[bufferFillPosition]),
-					bytesLeftInFile);
-			if (read == -1 && !readError) {
-				B(
-					fillStyle = 5;
-					debugHeader();
-					Serial.println("Read Error 9");
-				);
-				readError = true;
-				goto endfill;
-			}
-
-			if (looping) {
-				// If we're looping, seek back to start and fill from there
-				rawfile.seek(dataOffset);
-
-				read2 = rawfile.read(&(audioBuffer[bufferFillPosition + read]),
-						requiredBytes - bytesLeftInFile);
-				if (read2 == -1) {
-					B(
-						seekRequired = true;
-						seek = 0;
-						debugHeader();
-						Serial.println("Read Error 10");
-					);
-					readError = true;
-					goto endfill;
-				}
-
-				read += read2;
-				bytesLeftInFile = dataSize - read2;
-				bufferFillPosition += read;
-			} else {
-				// otherwise flag playback finished
-				finished = true;
+		(this->*kernels[kernel])(block->data, n, 0);
+		if (right != NULL) {
+			(this->*kernels[kernel])(right->data, n, bytesPerSample);
+			if (mixToMono) {
+				// Play the mix on both outputs
+				downmix(block->data, right->data);
+				release(right);
+				right = NULL;
 			}
-
 		}
 	}
 
-	endfill:
-
-	B(
+	M(
+		cycles = ARM_DWT_CYCCNT - cycles;
+		if (cycles > decodeCyclesMax) decodeCyclesMax = cycles;
+	);
 
-		if(bytesLeftInFile > (fileAvailable())) {
+	if (n != AUDIO_BLOCK_SAMPLES) {
+		B(
 			debugHeader();
-			Serial.print("BLIF > AVAIL. ");
-			Serial.print(bytesLeftInFile);
-			Serial.print(" != ");
-			Serial.print(fileAvailable());
-			Serial.print(". Read ");
-			Serial.print(read);
-			Serial.print(". Style ");
-			Serial.print(fillStyle);
-			Serial.print(" Name. ");
-			Serial.println(rawfile.name());
-			Serial.print(". File Pos ");
-			Serial.println(rawfile.position());
-			if((fileAvailable()) % bytesPerSample == 0) {
-				debugHeader();
-				Serial.println("Avail2 not aligned");
-			}
-		}
+			Serial.print("n != BLOCK : ");
+			Serial.println(n);
+		);
 
-		if(read == -1) {
-			debugHeader();
-			Serial.print("Read error. Fill style ");
-			Serial.println(fillStyle);
-			if(avail != (fileAvailable())) {
-				debugHeader();
-				Serial.print("Avail changed from ");
-				Serial.print(avail);
-				Serial.print(" to ");
-				Serial.println(fileAvailable());
-			}
-		} else if(read > requiredBytes) {
-			debugHeader();
-			Serial.print("Read too much ");
-			Serial.print(read);
-			Serial.print(" wanted ");
-			Serial.print(requiredBytes);
-			Serial.print(" fill style was ");
-			Serial.println(fillStyle);
-		} else if(read < requiredBytes) {
-			debugHeader();
-			Serial.print("Didn't read enough ");
-			Serial.print(read);
-			Serial.print(" wanted ");
-			Serial.print(requiredBytes);
-			Serial.print(" fill style was ");
-			Serial.println(fillStyle);
+		// The file has ended so everything that is left has been used.
+		bytesUsed = bytesAvailable;
+		phaseFraction = 0;
+		// Fill rest of block with zeros.
+		for (i = n; i < AUDIO_BLOCK_SAMPLES; i++) {
+			block->data[i] = 0;
 		}
-
-		if(seekRequired) {
-			if(seek) {
-				debugHeader();
-				Serial.print("Seek required but seek is high. ");
-				Serial.print("Fill style ");
-				Serial.println(fillStyle);
-			} else {
-				debugHeader();
-				Serial.print("Seek completed. ");
-				Serial.print("Fill style ");
-				Serial.println(fillStyle);
+		if (right != NULL) {
+			for (i = n; i < AUDIO_BLOCK_SAMPLES; i++) {
+				right->data[i] = 0;
 			}
 		}
+		finished = true;
+	} else {
+		bytesUsed = framesUsed * frameBytes;
+		// Only when the end of the file is in this block
+		if (bytesUsed > (uint32_t) bytesAvailable) bytesUsed = bytesAvailable;
+		phaseFraction = (uint32_t) endPhase;
+	}
 
-	);
-
-	if(read == -1 || readError) {
-		return false;
+	readPositionInBytes += bytesUsed;
+	if (readPositionInBytes >= bufferSize) readPositionInBytes -= bufferSize;
+
+	// Move the play position on by the frames used. prefetch() loops the file
+	// into the ring without a new stream, so wrap it the same way.
+	uint32_t frame = (playPosition >> 32) + bytesUsed / frameBytes;
+	if (frame >= streamFrames && streamFrames > 0) frame %= streamFrames;
+	playPosition = ((uint64_t) frame << 32) | phaseFraction;
+
+	// Hand the space back to prefetch()
+	__sync_synchronize();
+	readState = (RING_EPOCH(state) << RING_EPOCH_SHIFT) | readPositionInBytes;
+
+	transmit(block, 0);
+	if (right != NULL) {
+		transmit(right, 1);
+		release(right);
 	} else {
-		bytesAvailable += read;
-		bufferFillPosition %= AUDIOBUFSIZE;
-		bufferFills++;
-		if(bytesLeftInFile == 0) finished = true;
-		return true;
+		transmit(block, 1);
 	}
+	release(block);
+	inUpdate = false;
+	updates++;
 }
 
-// Progress in file scaled from 0 to 1
-float SDPlayPCM::offset(void) {
-	// For now fudge it a bit and shift it forward in time by 2 blocks.
-	uint32_t bytes = bytesLeftInFile <= (bytesRequired * 2) ? bytesLeftInFile : bytesLeftInFile - (bytesRequired * 2);
-	float off = (float)(dataSize - bytes) / dataSize;
+
+// Safe to call from loop(). update() can't run part way through reading the position.
+uint64_t SDPlayPCM::position(void) {
+	__disable_irq();
+	// Until update() picks up a new stream it's still where the stream will start
+	boolean pending = RING_EPOCH(readState) != RING_EPOCH(writeState);
+	uint64_t pos = playPosition;
+	__enable_irq();
+	if (pending) pos = (uint64_t) fileFormat.startFrame << 32;
 	D(
 		debugHeader();
-	Serial.print("Offset. Size ");
-	Serial.print(dataSize);
-	Serial.print("\t");
-	Serial.print(bytesLeftInFile);
-	Serial.print("\t");
-	Serial.println(off,4);
+		Serial.print("Position ");
+		Serial.print((uint32_t) (pos >> 32));
+		Serial.print(" of ");
+		Serial.println(fileFormat.frames);
 	);
-	return off;
+	return pos;
 }
 
 // Note rawfile.available() is clamped to 16 bit signed int
@@ -32,58 +32,211 @@
 #include <AudioStream.h>
 #include <SD.h>
 #include "AudioFileInfo.h"
+#include "Settings.h"
+#include "SDReader.h"
+
+class HeadCache;
 
 // Audio system AUDIO_BLOCK_SAMPLES is 128 and runs at 44k 16bit
 // This means we need 2 BLOCKS of bytes for a block 44k 16
 // 3 for 44k 24bit
 // 6.54 for 96k 24bit
-// TODO : Use 2 buffers. 1 for multiples of 44k and 1 for multiples of 48k
-// If there is a reasonable buffer size which is byte aligned at 48k
-// e.g. an 836 byte buffer would have enough samples to fill 3 blocks for 48/16 -> 44/16
-// NOTE : Make sure this is a factor of 2 AND 3 otherwise 24-bit samples will be split
-// across the buffer boundary and that will make things go wrong.
-#define AUDIOBUFSIZE (AUDIO_BLOCK_SAMPLES * 27)
+// So each player's ring buffer is sized for its file in changeFileTo(),
+// out of a pool shared by all players. Enough for every voice to have
+// READ_AHEAD_MS of 96k 16 bit stereo at normal speed.
+#define RING_POOL_SIZE (AUDIO_BLOCK_SAMPLES * 96 * MAX_VOICES)
+// How much audio prefetch() tries to keep ahead of playback
+#define READ_AHEAD_MS 25
+// Fastest playbackSpeed AudioEngine allows. Every ring holds at least a block at this speed.
+#define MAX_PLAYBACK_SPEED 4.4898
+
+// Sample encodings the decoder handles. Integer types are their size in bytes.
+#define SAMPLE_UINT8 1
+#define SAMPLE_INT16 2
+#define SAMPLE_INT24 3
+#define SAMPLE_INT32 4
+#define SAMPLE_FLOAT32 5
+#define SAMPLE_BYTES(type) ((type) == SAMPLE_FLOAT32 ? 4 : (type))
+
+// Windowed sinc interpolation kernel size
+#define SINC_TAPS 8
+#define SINC_PHASE_BITS 6
+#define SINC_PHASES (1 << SINC_PHASE_BITS)
+
+// Frames after the current one each interpolation mode reads.
+// Indexed by INTERPOLATION_NONE, LINEAR, HERMITE and SINC.
+static const uint8_t INTERPOLATION_LOOKAHEAD[4] = { 0, 1, 2, SINC_TAPS / 2 };
+
+// Faster than the output rate, sinc interpolation switches to a longer kernel
+// that's stretched to cut off below the output's Nyquist, so it doesn't alias.
+// Zero crossings either side of the centre
+#define RESAMPLE_ZEROS 8
+// Cutoff as a fraction of the output's Nyquist
+#define RESAMPLE_CUTOFF 0.9
+// Most it's stretched. Past this some aliasing gets through.
+#define RESAMPLE_MAX_RATIO 4
+// Frames either side of the current one the stretched kernel can read
+#define RESAMPLE_REACH (RESAMPLE_ZEROS * RESAMPLE_MAX_RATIO)
+// Points per zero crossing in the table the stretched kernel is read from
+#define RESAMPLE_KERNEL_RES 64
+
+// Decode kernels are built for the interpolation modes plus the stretched sinc
+#define KERNEL_RESAMPLE 4
+#define KERNEL_MODES 5
+
+// The ring buffer is shared lock free between prefetch(), called from loop(), and
+// update() in the audio interrupt. Each side owns one 32 bit state word holding its
+// position, so it can be read and written in one go.
+// Bits 0-19 : Position in the ring in bytes
+// Bit 20 : End of data. No more is coming for this stream (writeState only)
+// Bits 21-31 : Stream epoch. Bumped on every seek or file change.
+#define RING_POS(state) ((state) & 0xFFFFF)
+#define RING_END_OF_DATA (1 << 20)
+#define RING_EPOCH_SHIFT 21
+#define RING_EPOCH_MASK 0x7FF
+#define RING_EPOCH(state) ((state) >> RING_EPOCH_SHIFT)
+// Ring sizes are a multiple of every frame size (1, 2, 3, 4, 6 and 8 bytes)
+// so frames never straddle the end of the ring.
+#define RING_FRAME_ALIGN 24
+// Reads that start and end on SD_SECTOR boundaries go straight from the card
+// into the ring, as one multi sector read, without the library's cache.
+// Rings are a whole number of sectors too, when there's room, so the end of the
+// ring is on a sector boundary and reads never have to be split there.
+#define RING_SECTOR_ALIGN (SD_SECTOR * 3)
+// Bytes behind the read position that prefetch() leaves alone for interpolation
+#define RING_HISTORY (RESAMPLE_REACH * 8)
+// Smallest read prefetch() will make, unless the file is nearly done
+#define PREFETCH_MIN_READ (SD_SECTOR * 4)
+// Biggest ring allocateRing() can need at least. A block at the fastest speed of the
+// formats with the most bandwidth, like 96k 16 bit stereo or 48k float stereo.
+#define RING_MAX_MINIMUM (RING_SECTOR_ALIGN * 5)
+#if RING_POOL_SIZE < RING_MAX_MINIMUM * MAX_VOICES
+#error "The ring pool can't hold a ring for every voice"
+#endif
 
 // reference: https://www.pjrc.com/teensy/td_libs_AudioNewObjects.html
+// Output 0 is the left channel, output 1 the right. Mono files play on both.
 class SDPlayPCM: public AudioStream {
 public:
-	SDPlayPCM(void) : AudioStream(0, NULL) { begin(); }	
+	SDPlayPCM(void) : AudioStream(0, NULL) {
+		nextPlayer = firstPlayer;
+		firstPlayer = this;
+		begin();
+	}
 	void begin(void);
 	bool playFrom(AudioFileInfo* info);
+	// The last playFrom() failed because no gap in the ring pool was big enough.
+	// Stopping another player makes room.
+	bool ringPoolFull(void) { return noRingRoom; }
 	bool hasFinished(void) { return finished; }
 	void restart();
 	bool isPlaying(void) { return playing; }
+	// File last given to playFrom()
+	AudioFileInfo* playingFile(void) { return fileInfo; }
 	void stop(void);
 	void loopPlayback(bool loop);
+	void setInterpolation(uint8_t mode);
+	void setStereoMode(uint8_t mode);
+	// Start from audio cached in RAM when there is some, instead of waiting for the card.
+	void setCache(HeadCache* headCache) { cache = headCache; }
+	// Read files that are in one piece with DMA, so loop() doesn't wait for the card.
+	void setReader(SDReader* sdReader) { reader = sdReader; }
+	// Wait for a read on its way into the ring. Call before playFrom(), outside
+	// AudioNoInterrupts(), as a read can take up to the card's timeout.
+	void waitIdle(void);
 
 	bool skipTo(uint32_t dataOffset);
-	float offset(void);
+	// Frame being played, counted from the start of the audio data. 32.32 fixed point,
+	// the fraction is the resampler's phase towards the next frame.
+	uint64_t position(void);
 
+	// Read ahead from the SD card. Call this often from loop().
+	void prefetch(void);
 	virtual void update(void);
 
 	uint8_t playerID = 0;
 
-	volatile bool readError = false;
 	volatile float playbackSpeed = 1.0;
 
 	volatile uint16_t bufferFills = 0;
 	volatile uint16_t updates = 0;
 	volatile uint16_t errors = 0;
+	// Blocks played as silence because prefetch() hadn't read enough yet.
+	volatile uint16_t underruns = 0;
+	// Most CPU cycles spent decoding one block. Only counted with MEASURE_DECODE.
+	volatile uint32_t decodeCyclesMax = 0;
+	// Longest wait from skipTo() to the first block of audio, in microseconds. Only counted with MEASURE_DECODE.
+	volatile uint32_t startLatencyMax = 0;
 
 	File rawfile;
 	volatile bool inUpdate = false;
 	volatile bool updateRequired = false;
 
 private:
+	// The host harnesses in test/host look inside through this
+	friend struct HostTest;
+	typedef void (SDPlayPCM::*DecodeKernel)(int16_t* out, uint16_t n, int32_t channelOffset);
+
+	// What update() needs to know to decode a stream.
+	struct StreamFormat {
+		uint8_t bytesPerSample = 2;
+		uint8_t channels = 1;
+		// Decode kernels for the format, and for mixing it to mono. See selectKernels()
+		const DecodeKernel* kernels = NULL;
+		const DecodeKernel* mixKernels = NULL;
+		float sampleRateSpeed = 1.0;
+		unsigned char* ring = NULL;
+		int32_t ringSize = 0;
+		// Frame the stream starts on and the length of the file in frames
+		uint32_t startFrame = 0;
+		uint32_t frames = 0;
+		// Where in the ring the stream starts. See skipTo()
+		uint32_t ringStart = 0;
+	};
+
 	bool changeFileTo(AudioFileInfo* info, bool closeFirst);
+	bool openFile();
+	void finishRead();
+	static void readComplete(void* context, bool ok);
+	bool allocateRing(AudioFileInfo* info);
+	bool noRingRoom = false;
+	void startStream();
+	void silenceRing(int32_t position);
 
-	bool fillBuffer(int32_t requiredBytes);
-	void fastFillBuffer();
 	void debugHeader();
 	uint32_t fileAvailable();
 
-	// audioBuffer is a ring buffer
-	unsigned char audioBuffer[AUDIOBUFSIZE];
+	template<int TYPE, int CHANNELS, int MODE, bool WRAP, bool MIX>
+	void decode(int16_t* out, uint16_t n, int32_t channelOffset);
+	template<int TYPE, int CHANNELS, bool MIX> static const DecodeKernel* kernelsFor();
+	static const DecodeKernel* selectKernels(uint8_t sampleType, uint8_t channels, bool mix);
+	void copyUnity24(int16_t* left, int16_t* right, uint16_t n);
+	static void buildSincTable();
+	static int16_t sincTable[SINC_PHASES][SINC_TAPS];
+	// One side of the resampling kernel, zero crossings RESAMPLE_KERNEL_RES apart
+	static float resampleKernel[RESAMPLE_ZEROS * RESAMPLE_KERNEL_RES + 2];
+	static bool sincTableReady;
+
+	static unsigned char ringPool[RING_POOL_SIZE];
+	// Every player, so allocateRing() can see which parts of the pool are in use.
+	static SDPlayPCM* firstPlayer;
+	SDPlayPCM* nextPlayer;
+	// This player's part of the pool. Only used by the main loop. A stopped
+	// player's ring can be taken by another, then its size is 0.
+	uint32_t ringOffset = 0;
+	uint32_t ringSize = 0;
+
+	// Written only by prefetch()
+	volatile uint32_t writeState = 0;
+	// Written only by update()
+	volatile uint32_t readState = 0;
+	// Written only by update(). See position()
+	volatile uint64_t playPosition = 0;
+	// Formats for the last two epochs, so prefetch() can set up the next
+	// stream while update() may still be picking up the previous one.
+	StreamFormat streamFormats[2];
+	// Format of the open file
+	StreamFormat fileFormat;
 
 	// Speed to play different SRs at normal speed.
 	// 44100 is 1.0
@@ -94,28 +247,65 @@ private:
 	volatile bool playing;
 	volatile bool finished;
 	volatile bool looping;
-	volatile int bytesPerSample = 2;
-	volatile int32_t bytesAvailable = 0;
-	volatile int32_t readPositionInBytes = 0;
-	volatile uint32_t bufferFillPosition = 0;
+	volatile uint8_t interpolation = INTERPOLATION_NONE;
+	volatile uint8_t stereoMode = STEREO_MODE_STEREO;
+	// Decoding state. Only used by update()
+	// audioBuffer is a ring buffer
+	unsigned char* audioBuffer = NULL;
+	int32_t bufferSize = 0;
+	int bytesPerSample = 2;
+	uint16_t channels = 1;
+	const DecodeKernel* kernels = NULL;
+	const DecodeKernel* mixKernels = NULL;
+	int32_t readPositionInBytes = 0;
+	uint32_t streamFrames = 0;
+	bool starting = false;
 
-	String filename;
+	// File state. Only used by prefetch() and the main loop
+	// Points into fileNames
+	const char* filename;
+	AudioFileInfo* fileInfo = NULL;
+	HeadCache* cache = NULL;
+	// Opening and seeking are left to prefetch(), so what's cached can be played first.
+	bool openPending = false;
+	bool seekPending = false;
+	// Reading with DMA. First sector of the file, 0 if it isn't in one piece
+	SDReader* reader = NULL;
+	uint32_t firstSector = 0;
+	// What's just behind the write position is the file's data before it, or
+	// nothing yet. Not so once the file loops back to its start.
+	bool ringFollowsFile = true;
+	// A read on its way into the ring, set done by readComplete()
+	bool readPending = false;
+	volatile bool readDone = false;
+	volatile bool readOk = false;
+	uint32_t readEpoch = 0;
+	uint32_t readPosition = 0;
+	uint32_t readLead = 0;
+	int32_t readLength = 0;
+	// Reads that aren't whole sectors of the ring come through here
+	bool readBounced = false;
+	unsigned char sectorBuffer[SD_SECTOR] __attribute__ ((aligned (4)));
+	// When skipTo() started the stream
+	volatile uint32_t startMicros = 0;
 	uint32_t dataSize = 0;
 	uint32_t dataOffset = 0;
-	uint16_t channels = 1;
-
 	int32_t bytesLeftInFile = 0;
 
-	uint32_t l0 = 0;
-	uint32_t lowSamplePos = 0;
 	uint32_t bytesUsed = 0;
-	uint16_t spaceLeftInBuffer = 0;
 	int32_t bytesRequired = 0;
-	int32_t read = 0;
 
-//	// Fixed point phase. 5 bit integer 11 bit fractional
-//	// This is phase in samples, not bytes.
-//	uint32_t phaseIncrement = 0;
+	// Fixed point phase. 32 bit integer 32 bit fractional
+	// This is phase in frames, not bytes. The integer part is consumed
+	// at the end of each block, the fraction carries on to the next one.
+	uint64_t phaseIncrement = 1ULL << 32;
+	uint32_t phaseFraction = 0;
+	// Speed phaseIncrement was calculated for
+	float phaseSpeed = 1.0;
+	// Sinc kernel stretch for phaseSpeed. 1.0 is not stretched.
+	float resampleScale = 1.0;
+	// Frames either side the stretched kernel reads
+	uint16_t resampleReach = RESAMPLE_ZEROS;
 };
 
 #endif
@@ -0,0 +1,151 @@
+#include "SDReader.h"
+
+#include "RawWaves.h"
+
+#ifdef DEBUG_SD_READER
+#define D(x) x
+#else
+#define D(x)
+#endif
+
+bool SPISectorDevice::begin() {
+#ifdef BUILTIN_SDCARD
+	// The SD library drives the built in slot over SDIO. Its card isn't an SdSpiCard.
+	if (SD_CHIP_SELECT == BUILTIN_SDCARD) return false;
+#endif
+	card = static_cast<SdSpiCard*>(SD.sdfs.card());
+	if (card == NULL) return false;
+	event.setContext(this);
+	// Only sets a flag, so it's fine in the DMA interrupt
+	event.attachImmediate(transferred);
+	// The card wants 0xFF while it's sending
+	SPI.setTransferWriteFill(0xFF);
+	return true;
+}
+
+bool SPISectorDevice::readStart(uint32_t sector) {
+	return card->readStart(sector);
+}
+
+uint8_t SPISectorDevice::receiveByte() {
+	return SPI.transfer(0xFF);
+}
+
+bool SPISectorDevice::receive(uint8_t* data, uint16_t count) {
+	transferDone = false;
+	if (!SPI.transfer(NULL, data, count, event)) {
+		transferDone = true;
+		return false;
+	}
+	return true;
+}
+
+bool SPISectorDevice::readStop() {
+	return card->readStop();
+}
+
+void SPISectorDevice::transferred(EventResponderRef event) {
+	((SPISectorDevice*) event.getContext())->transferDone = true;
+}
+
+void SDReader::begin(SectorDevice* sectorDevice) {
+	device = sectorDevice;
+	first = 0;
+	queued = 0;
+	state = SD_READ_IDLE;
+}
+
+bool SDReader::read(uint32_t sector, uint16_t count, uint8_t* data, Callback callback, void* context) {
+	if (device == NULL || queued == SD_READ_QUEUE || count == 0) return false;
+	Request& request = queue[(first + queued) % SD_READ_QUEUE];
+	request.sector = sector;
+	request.count = count;
+	request.data = data;
+	request.callback = callback;
+	request.context = context;
+	queued++;
+	return true;
+}
+
+// Goes as far as it can without waiting for the card. A sector's CRC is read
+// and checked and the next one asked for as soon as its DMA is done, the next
+// request started as soon as one is finished.
+void SDReader::poll() {
+	while (queued > 0) {
+		Request& request = queue[first];
+		if (state == SD_READ_IDLE) {
+			start();
+		} else if (state == SD_READ_TOKEN) {
+			uint8_t token = device->receiveByte();
+			if (token == 0xFF) {
+				if (micros() - tokenMicros > SD_READ_TIMEOUT_US) {
+					D(Serial.print("SD: Timed out at sector ");Serial.println(request.sector + done););
+					finish(false);
+				}
+				return;
+			}
+			if (token != SD_DATA_START || !device->receive(&request.data[done * SD_SECTOR], SD_SECTOR)) {
+				D(Serial.print("SD: Read error ");Serial.print(token, HEX);Serial.print(" at sector ");Serial.println(request.sector + done););
+				finish(false);
+			} else {
+				state = SD_READ_DATA;
+			}
+		} else {
+			if (!device->done()) return;
+			uint16_t crc = device->receiveByte() << 8;
+			crc |= device->receiveByte();
+			if (SD_READ_CRC && crc != sectorCrc(&request.data[done * SD_SECTOR])) {
+				D(Serial.print("SD: Bad CRC at sector ");Serial.println(request.sector + done););
+				crcErrors++;
+				finish(false);
+				continue;
+			}
+			sectors++;
+			done++;
+			if (done < request.count) {
+				state = SD_READ_TOKEN;
+				tokenMicros = micros();
+			} else {
+				finish(true);
+			}
+		}
+	}
+}
+
+void SDReader::start() {
+	Request& request = queue[first];
+	done = 0;
+	if (!device->readStart(request.sector)) {
+		D(Serial.print("SD: Can't start a read at sector ");Serial.println(request.sector););
+		finish(false);
+		return;
+	}
+	state = SD_READ_TOKEN;
+	tokenMicros = micros();
+}
+
+// Take the request off the queue before calling back, so the callback can queue another
+void SDReader::finish(bool ok) {
+	if (state != SD_READ_IDLE) device->readStop();
+	Request request = queue[first];
+	first = (first + 1) % SD_READ_QUEUE;
+	queued--;
+	state = SD_READ_IDLE;
+	if (!ok) errors++;
+	if (request.callback != NULL) request.callback(request.context, ok);
+}
+
+// CRC16-CCITT, polynomial 0x1021 from 0, four bits at a time. Two table lookups
+// a byte, in loop() once the DMA is done.
+uint16_t SDReader::sectorCrc(const uint8_t* data) {
+	static const uint16_t table[16] = {
+		0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+		0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+	};
+	uint16_t crc = 0;
+	for (uint16_t i = 0; i < SD_SECTOR; i++) {
+		crc = (crc << 4) ^ table[(crc >> 12) ^ (data[i] >> 4)];
+		crc = (crc << 4) ^ table[(crc >> 12) ^ (data[i] & 0x0F)];
+	}
+	return crc;
+}
@@ -0,0 +1,116 @@
+#ifndef SDReader_h
+#define SDReader_h
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <SD.h>
+#include <EventResponder.h>
+#include "Settings.h"
+
+// Reads whole sectors from the SD card without waiting for them. Requests are
+// queued and worked through by a state machine moved on by poll(), while SPI DMA
+// brings each sector into the caller's buffer and loop() gets on with other things.
+// The SD library can only use the card again once the reader is idle().
+
+// SD cards read in sectors
+#define SD_SECTOR 512
+// Chip select of the card. openSDCard() starts the SD library on it. BUILTIN_SDCARD
+// would put the card on SDIO, which SPISectorDevice can't drive.
+#define SD_CHIP_SELECT SS
+// Check each sector against the CRC16 the card sends after it, and fail the
+// request if they differ. 0 to take sectors as they come, like the SD library.
+#define SD_READ_CRC 1
+// Most requests waiting at once. One for each player.
+#define SD_READ_QUEUE MAX_VOICES
+// Longest the card can take to start sending a sector. The SD spec's read timeout.
+#define SD_READ_TIMEOUT_US 100000
+// The card sends 0xFF while it gets a sector ready, then this
+#define SD_DATA_START 0xFE
+
+// Reader states
+// Nothing in flight. The next request starts on the next poll().
+#define SD_READ_IDLE 0
+// Read command sent, waiting for the card's data start token
+#define SD_READ_TOKEN 1
+// DMA moving a sector
+#define SD_READ_DATA 2
+
+// What the reader needs from the card. The Teensy's is SPISectorDevice below,
+// a simulated one can be used to test the reader.
+class SectorDevice {
+	public:
+		// Send the multiple sector read command
+		virtual bool readStart(uint32_t sector) = 0;
+		// One byte from the card
+		virtual uint8_t receiveByte() = 0;
+		// Start moving count bytes into data. done() is true once they're all there.
+		virtual bool receive(uint8_t* data, uint16_t count) = 0;
+		virtual bool done() = 0;
+		// Stop the multiple sector read and let go of the bus
+		virtual bool readStop() = 0;
+};
+
+// The card on SPI, with the SD library's card driver for the commands and
+// an SPI DMA transfer for each sector.
+class SPISectorDevice : public SectorDevice {
+	public:
+		// Call after SD.begin(). False if the card isn't on SPI, then the SD library has to read it.
+		bool begin();
+		bool readStart(uint32_t sector);
+		uint8_t receiveByte();
+		bool receive(uint8_t* data, uint16_t count);
+		bool done() { return transferDone; }
+		bool readStop();
+
+	private:
+		static void transferred(EventResponderRef event);
+		SdSpiCard* card = NULL;
+		EventResponder event;
+		volatile bool transferDone = true;
+};
+
+class SDReader {
+	public:
+		// Called with the request's context once all its sectors are in, or it's failed.
+		typedef void (*Callback)(void* context, bool ok);
+
+		void begin(SectorDevice* sectorDevice);
+		// Queue count sectors from sector into data. False if the queue's full.
+		bool read(uint32_t sector, uint16_t count, uint8_t* data, Callback callback, void* context);
+		// Move the reader on. Call often from loop().
+		void poll();
+		// Nothing queued or in flight, so the SD library can use the card.
+		boolean idle() { return queued == 0; }
+
+		SectorDevice* device = NULL;
+		// Sectors read, and requests that failed. crcErrors of them on a bad CRC.
+		uint32_t sectors = 0;
+		uint16_t errors = 0;
+		uint16_t crcErrors = 0;
+
+		// CRC16 of a sector, as the card works it out
+		static uint16_t sectorCrc(const uint8_t* data);
+
+	private:
+		struct Request {
+			uint32_t sector = 0;
+			uint16_t count = 0;
+			uint8_t* data = NULL;
+			Callback callback = NULL;
+			void* context = NULL;
+		};
+
+		void start();
+		void finish(bool ok);
+
+		Request queue[SD_READ_QUEUE];
+		// Oldest request, the one being read, and how many there are
+		uint8_t first = 0;
+		uint8_t queued = 0;
+		uint8_t state = SD_READ_IDLE;
+		// Sectors of the current request done so far
+		uint16_t done = 0;
+		uint32_t tokenMicros = 0;
+};
+
+#endif
@@ -87,6 +87,12 @@ void Settings::read() {
 	drumMode();
 #endif
 
+	// Cards set up before the voice pool keep the hard cut they've always had.
+	// A voices line in settings.txt turns the pool on for them.
+	if((anyAudioFiles || pitchMode) && !voicesSet) {
+		hardSwap = true;
+	}
+
 	if(!loopMode) {
 		if(pitchMode) {
 			loopMode = LOOP_MODE_START_POINT;
@@ -96,10 +102,6 @@ void Settings::read() {
 	}
 
 	D(Serial.print("Loop mode ");Serial.println(loopMode););
-
-	if(anyAudioFiles || pitchMode) {
-		hardSwap = true;
-	}
 }
 
 void Settings::drumMode() {
@@ -115,7 +117,9 @@ void Settings::drumMode() {
 	looping=1;
 	sort=1;
 	pitchMode=1;
-	hardSwap = true;
+	hardSwap = false;
+	voicesSet = true;
+	releaseTime = 100;
 	anyAudioFiles = true;
 	loopMode = LOOP_MODE_START_POINT;
 }
@@ -191,6 +195,9 @@ void Settings::applySetting(String settingName, String settingValue) {
 		case hash("sort"):
 			sort = toBoolean(settingValue);
 			break;
+		case hash("naturalsort"):
+			naturalSort = toBoolean(settingValue);
+			break;
 		case hash("anyaudiofiles"):
 			anyAudioFiles = toBoolean(settingValue);
 			break;
@@ -213,6 +220,35 @@ void Settings::applySetting(String settingName, String settingValue) {
 		case hash("loopmode"):
 			loopMode = settingValue.toInt();
 			break;
+		case hash("interpolation"):
+			interpolation = settingValue.toInt();
+			if(interpolation > INTERPOLATION_SINC) interpolation = INTERPOLATION_SINC;
+			break;
+		case hash("stereomode"):
+			stereoMode = settingValue.toInt();
+			if(stereoMode > STEREO_MODE_MONO) stereoMode = STEREO_MODE_STEREO;
+			break;
+		case hash("ramfilekb"):
+			ramFileKB = settingValue.toInt();
+			break;
+		case hash("voices"):
+			if(settingValue.toInt() < 1 || settingValue.toInt() > MAX_VOICES) {
+				Serial.print("voices must be 1 to ");
+				Serial.println(MAX_VOICES);
+				break;
+			}
+			voices = settingValue.toInt();
+			voicesSet = true;
+			break;
+		case hash("releasetime"):
+			releaseTime = settingValue.toInt();
+			break;
+		case hash("dmareads"):
+			dmaReads = toBoolean(settingValue);
+			break;
+		case hash("filetablekb"):
+			fileTableKB = settingValue.toInt();
+			break;
 		case hash("quantisenotecv"):
 		case hash("quantizerootcv"): // falling through again
 			quantiseRootCV = toBoolean(settingValue);
@@ -14,6 +14,31 @@
 // Use start point from interface
 #define LOOP_MODE_START_POINT 3
 
+// How the PCM players read between samples when playing at other speeds
+// or sample rates. Higher settings cost more CPU.
+// Nearest sample. Cheapest, aliases when pitched.
+#define INTERPOLATION_NONE 0
+#define INTERPOLATION_LINEAR 1
+// 4 point cubic Hermite
+#define INTERPOLATION_HERMITE 2
+// 8 point windowed sinc. When playing faster than 44.1k, from 88.2k or 96k
+// files or when pitched up, it also filters out what would alias.
+#define INTERPOLATION_SINC 3
+
+// What goes to the two DAC channels when playing stereo files.
+// Mono files always play on both.
+// Left to channel 0, right to channel 1
+#define STEREO_MODE_STEREO 0
+// Left channel only, on both outputs
+#define STEREO_MODE_LEFT 1
+// Left and right mixed to mono, on both outputs
+#define STEREO_MODE_MONO 2
+
+// Most players that can play at once. The audio engine gives each one an
+// input on a single AudioMixer4, so this can't go above 4. They share the
+// ring buffer pool.
+#define MAX_VOICES 4
+
 class Settings {
 public:
 	Settings(const char* filename);
@@ -47,6 +72,7 @@ public:
 	boolean looping = false; // When a file finishes, start again from the beginning
 
 	boolean sort = true; // By default we sort the directory contents.
+	boolean naturalSort = false; // Sort numbers in names by value, so 2.wav comes before 10.wav
 
 	// Use start pot and cv to control speed instead of start point
 	boolean pitchMode = false;
@@ -60,8 +86,33 @@ public:
 
 	uint8_t loopMode = 0;
 
+	uint8_t interpolation = INTERPOLATION_NONE;
+
+	uint8_t stereoMode = STEREO_MODE_STEREO;
+
+	// Files up to this many KB are loaded whole into RAM when their bank is chosen,
+	// so they play and retrigger without the SD card. 0 turns it off.
+	uint16_t ramFileKB = 64;
+
+	// Voices that can play at once, up to MAX_VOICES. Retriggers ring out on
+	// their own voice until they fade, or are stolen oldest first. Unless this
+	// is set, anyAudioFiles or pitchMode force hardSwap on, as they always have.
+	uint8_t voices = MAX_VOICES;
+	// Milliseconds a voice fades out for when another starts. 0 for the crossfade time.
+	uint16_t releaseTime = 0;
+
+	// Read files that are in one piece from the card with SPI DMA
+	boolean dmaReads = true;
+
+	// Most KB the file table can take, 24 bytes a file. Files past it are skipped.
+	// It shares the heap in RAM2 with the two scan indexes, 32 bytes a file each,
+	// and is made smaller if they wouldn't all fit. See HEAD_CACHE_SIZE.
+	uint16_t fileTableKB = 24;
+
 private:
 	const char* _filename;
+	// voices was in settings.txt, so hardSwap isn't forced on
+	boolean voicesSet = false;
 	File settingsFile;
 	void radioMode();
 	void drumMode();
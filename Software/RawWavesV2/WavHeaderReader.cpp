@@ -13,179 +13,187 @@
 
 /* 
 The WavHeaderReader class is used to read the header of a wav file.
-The header is the first 44 bytes of the file.
 It contains information about the audio file such as sample rate, bit depth, number of channels and the length of the audio data.
 The header is used to set up the audio system to play the file.
 The header is also used to determine the length of the file so that the file can be played from start to finish.
+
+The start of the file is read in one go and the chunks are found in memory. The file is only
+read again for a chunk past that, after a big one like a long LIST chunk. Every chunk has to
+fit inside the RIFF size and the file, so a broken or cut short file can't keep it looking.
 */
 
 boolean WavHeaderReader::read(File* file, AudioFileInfo& info) {
 
+	uint8_t data[WAV_HEADER_BUFFER];
 	waveFile = file;
+	buffer = data;
+	bufferStart = 0;
+	bufferLength = 0;
+
+	uint32_t length = waveFile->size();
+	D(Serial.print("File size "); Serial.println(length););
+
+	// WAV header, part 1:	RIFF
+	// 	Description: RIFF file description header
+	//  Usual contents: "The ASCII text string "RIFF"
+	//  Size: 4 bytes
+	// WAV header, part 2: <file length>
+	// 	Description: Size of file
+	//  Usual contents: Size of the overall file LESS 8 bytes (less part 1 "RIFF", above, and this part 2 <file length>)
+	//  Size: 4 bytes
+	// WAV header, part 3:	WAVE
+	// 	Description: The WAV description header
+	//  Usual contents: "The ASCII text string "WAVE"
+	//  Size: 4 bytes
+	if (!load(0, 12) || getLong(0) != WAV_ID_RIFF || getLong(8) != WAV_ID_WAVE) {
+		D(Serial.println("Not a RIFF WAVE file"); );
+		return false;
+	}
 
-	if (waveFile->available()) {
-		D(
-			Serial.print("Bytes available ");
-			Serial.println(waveFile->available());
-		);
-		uint32_t chunkSize = 0;
-
-		// WAV header, part 1:	RIFF
-		// 	Description: RIFF file description header
-		//  Usual contents: "The ASCII text string "RIFF"
-		//  Size: 4 bytes
-		if (!waveFile->seek(4)) {
-			D(Serial.println("Seek past RIFF failed"); );
+	// Chunks have to end by here. Some writers leave the RIFF size at 0 or too big, so the file's size is used then.
+	uint32_t riffSize = getLong(4);
+	uint32_t end = riffSize >= 4 && riffSize <= length - 8 ? riffSize + 8 : length;
+	D(Serial.print("RIFF size "); Serial.println(riffSize););
+
+	// The chunks after WAVE. Each is an ID, a 4 byte size and then that many bytes, plus one to keep it even.
+	// They're walked until 'fmt ' and 'data' have both been seen. Each step moves on at least 8 bytes.
+	uint32_t position = 12;
+	uint32_t fmtPosition = 0;
+	uint32_t fmtSize = 0;
+	boolean foundData = false;
+	while (end - position >= 8 && (fmtPosition == 0 || !foundData)) {
+		if (!load(position, 8)) {
+			D(Serial.println("Chunk header read failed"); );
 			return false;
-		} else {
-			D(Serial.print("Cur Pos "); Serial.println(waveFile->position()););
 		}
-
-		// WAV header, part 2: <file length>
-		// 	Description: Size of file
-		//  Usual contents: Size of the overall file LESS 8 bytes (less part 1 "RIFF", above, and this part 2 <file length>)
-		//  Size: 4 bytes
-		uint32_t fileSize = readLong();
-		D(Serial.print("File size "); Serial.println(fileSize););
-
-		// WAV header, part 3:	WAVE
-		// 	Description: The WAV description header
-		//  Usual contents: "The ASCII text string "WAVE"
-		//  Size: 4 bytes
-
-		// 'WAVE' as little endian uint32 is 1163280727
-		// If chunk ID isnt 'WAVE' stop here.
-		if (readLong() != 1163280727) {
-			D(Serial.println("Chunk ID not WAVE"); );
-			return false;
+		uint32_t id = getLong(position);
+		uint32_t chunkSize = getLong(position + 4);
+		uint32_t contents = position + 8;
+		D(Serial.print("Chunk "); Serial.print(id, HEX); Serial.print(" of "); Serial.print(chunkSize); Serial.print(" at "); Serial.println(position););
+
+		if (id == WAV_ID_FMT) {
+			fmtPosition = contents;
+			fmtSize = chunkSize;
+		} else if (id == WAV_ID_DATA) {
+			// WAV header, part 13: <data chunk length>
+			// 	Description: Size of audio data to follow, in bytes
+			//  Usual contents: (size of file) - 44
+			//  Size: 4 bytes
+			// Cut short files and ones written while recording can say there's more than there is
+			info.dataOffset = contents;
+			info.size = min(chunkSize, end - contents);
+			foundData = true;
+			D(Serial.print("WAV data length "); Serial.println(info.size););
 		}
 
-		// WAV header, part 4: "fmt "
-		// 	Description: Format chunk marker
-		//  Usual contents: "The ASCII text string "fmt " (note the trailing space)
-		//  Size: 4 bytes
-		uint32_t nextID = readLong();
-		// Keep skipping chunks until we hit 'fmt '
-		while (nextID != 544501094) {
-			chunkSize = readLong();
-			D(Serial.print("Skipping "); Serial.println(chunkSize););
-			waveFile->seek(waveFile->position() + chunkSize);
-			nextID = readLong();
-		}
+		// Stop rather than wrap if the size runs past the end
+		if (chunkSize >= end - contents) break;
+		position = contents + chunkSize + (chunkSize & 1);
+	}
 
-		if (!waveFile->available()) {
-			D(Serial.println("Skipped whole file"); );
-			return false;
-		}
+	if (fmtPosition == 0 || !foundData) {
+		D(Serial.println("No fmt or data chunk"); );
+		return false;
+	}
 
-		D(Serial.print("Found fmt chunk at "); Serial.println(waveFile->position()););
-
-		// WAV header, part 5: <format chunk length>
-		// 	Description: A number of formatting values are about to be presented in the file. Before presenting these values,
-		//				This 4-byte number will give the total number of bytes that these values will occupy.
-		//				These values are going to be: 
-		//					* The audio format type (usually 2 bytes)
-		// 					* The number of channels (2 bytes)
-		// 					* The sample rate (4 bytes)
-		// 					* The byte rate, bytes/sec (4 bytes)
-		// 					* The block alignment (2 bytes)
-		// 					* The number of bits per sample (2 bytes)
-		//  Usual contents: Usually the value 16, as you can see from the above list of values.
-		//  Size: 4 bytes
-		chunkSize = readLong();
-		D(Serial.print("Format Chunk Size "); Serial.println(chunkSize););
-
-		// WAV header, part 6: <Audio format type>
-		// 	Description: Type of WAV format
-		//  Usual contents: (0x01) = PCM
-		//  Size: 2 bytes
-		uint16_t format = readShort();
-
-		// WAV header, part 7: <Number of channels>
-		// 	Description: Number of audio channels
-		//  Usual contents: (0x01) = mono, (0x02) = stereo
-		//  Size: 2 bytes
-		info.setChannels(readShort());
-		D(Serial.print("Is Stereo : "); Serial.println(info.format & STEREO););
-
-		// WAV header, part 8: <Sample rate>
-		// 	Description: Sample rate in Hz
-		//  Usual contents: 8000, 44100, etc.
-		//  Size: 4 bytes
-		if(!info.setSampleRate(readLong())) {
-			return false;
-		}
+	// WAV header, part 5: <format chunk length>
+	// 	Description: A number of formatting values are about to be presented in the file. Before presenting these values,
+	//				This 4-byte number will give the total number of bytes that these values will occupy.
+	//				These values are going to be: 
+	//					* The audio format type (usually 2 bytes)
+	// 					* The number of channels (2 bytes)
+	// 					* The sample rate (4 bytes)
+	// 					* The byte rate, bytes/sec (4 bytes)
+	// 					* The block alignment (2 bytes)
+	// 					* The number of bits per sample (2 bytes)
+	//  Usual contents: Usually the value 16, as you can see from the above list of values.
+	if (fmtSize < 16 || fmtSize > end - fmtPosition || !load(fmtPosition, min(fmtSize, (uint32_t) WAV_FMT_READ))) {
+		D(Serial.print("Bad fmt chunk of "); Serial.println(fmtSize););
+		return false;
+	}
 
-		// WAV header, part 9: <Byte rate>
-		// 	Description: Average bytes per second
-		//  Usual contents: Sample rate * number of channels * bits per sample / 8
-		//  Size: 4 bytes
-		uint32_t byteRate = readLong();
-
-		// WAV header, part 10: <Block alignment>
-		// 	Description: Block size of data
-		//  Usual contents: Number of channels * bits per sample / 8
-		//  Size: 2 bytes
-		uint16_t blockAlign = readShort();
-
-		// WAV header, part 11: <Bits per sample>
-		// 	Description: Number of bits per sample
-		//  Usual contents: 8 bits = 8, 16 bits = 16, etc.
-		//  Size: 2 bytes
-		uint16_t bitsPerSample = readShort();
-		if (bitsPerSample % 8 != 0) {
-			D(Serial.print("Unsupported bit depth "); Serial.println(bitsPerSample););
-			return false;
-		}
-		info.setBitsPerSample(bitsPerSample);
+	// WAV header, part 6: <Audio format type>
+	// 	Description: Type of WAV format
+	//  Usual contents: (0x01) = PCM, (0x03) = IEEE float, (0xFFFE) = Extensible
+	uint16_t format = getShort(fmtPosition);
+	D(Serial.print("Format "); Serial.println(format, HEX););
+
+	// WAV header, part 7: <Number of channels>
+	// 	Description: Number of audio channels
+	//  Usual contents: (0x01) = mono, (0x02) = stereo
+	uint16_t channels = getShort(fmtPosition + 2);
+	if (channels != 1 && channels != 2) {
+		D(Serial.print("Unsupported channels "); Serial.println(channels););
+		return false;
+	}
+	info.setChannels(channels);
+	D(Serial.print("Is Stereo : "); Serial.println(info.format & STEREO););
+
+	// WAV header, part 8: <Sample rate>
+	// 	Description: Sample rate in Hz
+	//  Usual contents: 8000, 44100, etc.
+	// Parts 9 and 10, the byte rate and block alignment, follow but aren't needed.
+	if(!info.setSampleRate(getLong(fmtPosition + 4))) {
+		return false;
+	}
 
-		if (chunkSize > 16) {
-			D(Serial.print("Format chunk is extended "); Serial.println(chunkSize););
-			waveFile->seek(waveFile->position() + chunkSize - 16);
-		}
+	// WAV header, part 11: <Bits per sample>
+	// 	Description: Number of bits per sample
+	//  Usual contents: 8 bits = 8, 16 bits = 16, etc.
+	uint16_t bitsPerSample = getShort(fmtPosition + 14);
+	if (bitsPerSample % 8 != 0 || bitsPerSample == 0 || bitsPerSample > 32) {
+		D(Serial.print("Unsupported bit depth "); Serial.println(bitsPerSample););
+		return false;
+	}
+	info.setBitsPerSample(bitsPerSample);
+
+	if (format == WAVE_FORMAT_EXTENSIBLE && fmtSize >= 40) {
+		// WAV header, part 11a: Extensible format
+		//  Extension size (2 bytes), valid bits per sample (2 bytes), channel mask (4 bytes)
+		//  then the sub format GUID. Its first 2 bytes are the format tag.
+		format = getShort(fmtPosition + 24);
+		D(Serial.print("Extensible sub format "); Serial.println(format, HEX););
+	}
 
-		// WAV header, part 12: "data"
-		// 	Description: Data chunk marker
-		//  Usual contents: The ASCII text string "data"
-		//  Size: 4 bytes
-		// 'data' as little endian uint32 is 1635017060
-		while (readLong() != 1635017060) {
-			chunkSize = readLong();
-			waveFile->seek(waveFile->position() + chunkSize);
+	if (format == WAVE_FORMAT_IEEE_FLOAT) {
+		if (bitsPerSample != 32) {
+			D(Serial.print("Unsupported float size "); Serial.println(bitsPerSample););
+			return false;
 		}
-
-		// WAV header, part 13: <data chunk length>
-		// 	Description: Size of audio data to follow, in bytes
-		//  Usual contents: (size of file) - 44
-		//  Size: 4 bytes
-		chunkSize = readLong();
-		D(Serial.print("WAV data length "); Serial.println(chunkSize););
-		info.size = chunkSize;
-		info.dataOffset = waveFile->position();
-	} else {
-		D(Serial.println("File not available"); );
+		info.setFloat();
+	} else if (format != WAVE_FORMAT_PCM) {
+		D(Serial.print("Unsupported format "); Serial.println(format, HEX););
+		return false;
 	}
+
+	// A data chunk that was cut short can end part way through a frame
+	info.size -= info.size % info.getBytesPerFrame();
+
 	return true;
 }
 
-uint16_t WavHeaderReader::readShort() {
-	uint16_t val = waveFile->read();
-	val = waveFile->read() << 8 | val;
-	return val;
+boolean WavHeaderReader::load(uint32_t position, uint16_t length) {
+	if (position >= bufferStart && position - bufferStart + length <= bufferLength) {
+		return true;
+	}
+	// Start the buffer at the chunk, so what follows it comes in too
+	if (!waveFile->seek(position)) {
+		D(Serial.print("Seek failed to "); Serial.println(position););
+		return false;
+	}
+	int got = waveFile->read(buffer, WAV_HEADER_BUFFER);
+	bufferStart = position;
+	bufferLength = got > 0 ? got : 0;
+	return bufferLength >= length;
 }
 
 // WAV files are little endian
-uint32_t WavHeaderReader::readLong() {
+uint16_t WavHeaderReader::getShort(uint32_t position) {
+	uint8_t* bytes = &buffer[position - bufferStart];
+	return bytes[0] | bytes[1] << 8;
+}
 
-	int32_t val = waveFile->read();
-	if (val == -1) {
-		D(Serial.println("Long read error. 1"); );
-	}
-	for (byte i = 8; i < 32; i += 8) {
-		val = waveFile->read() << i | val;
-		if (val == -1) {
-			D(Serial.print("Long read error "); Serial.println(i););
-		}
-	}
-	return val;
+uint32_t WavHeaderReader::getLong(uint32_t position) {
+	uint8_t* bytes = &buffer[position - bufferStart];
+	return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t) bytes[3] << 24;
 }
@@ -4,15 +4,38 @@
 #include "SD.h"
 #include "AudioFileInfo.h"
 
+// Format tags
+#define WAVE_FORMAT_PCM 		0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 	0x0003
+// The real format is the first 2 bytes of the sub format GUID in the extended part of the chunk
+#define WAVE_FORMAT_EXTENSIBLE 	0xFFFE
+
+// Chunk IDs as little endian uint32
+#define WAV_ID_RIFF	0x46464952
+#define WAV_ID_WAVE	0x45564157
+#define WAV_ID_FMT	0x20746D66
+#define WAV_ID_DATA	0x61746164
+
+// Bytes read at once. Two sectors, enough for the usual header and a LIST chunk or two.
+#define WAV_HEADER_BUFFER 1024
+// Most of the format chunk that's looked at. The extensible part ends with the sub format tag.
+#define WAV_FMT_READ 26
+
 class WavHeaderReader {
 public:
 	// Return true if header was read successfully
 	boolean read(File* file, AudioFileInfo& info);
 private:
-	uint32_t readLong();
-	uint16_t readShort();
+	// Have length bytes from position in the buffer. Only reads the file if they aren't already.
+	boolean load(uint32_t position, uint16_t length);
+	uint16_t getShort(uint32_t position);
+	uint32_t getLong(uint32_t position);
 
 	File* waveFile;
+	// The bytes of the file from bufferStart, on read()'s stack
+	uint8_t* buffer;
+	uint32_t bufferStart;
+	uint16_t bufferLength;
 };
 
 #endif
@@ -0,0 +1,107 @@
+#pragma once
+// Files held in memory behind a model of SdFat on an SPI card. A read that covers
+// whole, aligned sectors goes straight to the caller as one multi-block command.
+// Anything else goes through a one sector cache, a command for each sector it loads.
+#include <Arduino.h>
+#include <sdfat_stub.h>
+#include <vector>
+#include <map>
+#include <memory>
+
+#define FILE_READ 0
+#define FILE_WRITE 1
+#define O_RDONLY 0
+
+struct SimFile {
+	std::string name;
+	std::vector<uint8_t> data;
+};
+extern std::map<std::string, std::shared_ptr<SimFile>> simFiles;
+
+struct CardStats {
+	long commands = 0, sectors = 0, calls = 0, bytes = 0;
+};
+inline CardStats card;
+
+// SdFat's cache, shared by every file
+inline SimFile* cacheFile = NULL;
+inline long cacheSector = -1;
+
+class File : public Print {
+public:
+	std::shared_ptr<SimFile> f;
+	uint64_t p = 0;
+	File() {}
+	File(std::shared_ptr<SimFile> x) : f(x) {}
+	operator bool() const { return (bool) f; }
+	int read() { uint8_t c; return read(&c, 1) == 1 ? c : -1; }
+	int read(void* b, size_t n) {
+		if (!f) return -1;
+		n = min(n, (size_t) (f->data.size() - p));
+		uint8_t* to = (uint8_t*) b;
+		size_t left = n;
+		card.calls++;
+		card.bytes += n;
+		while (left) {
+			long sector = p / 512;
+			size_t offset = p % 512;
+			size_t m;
+			if (offset == 0 && left >= 512) {
+				// Multi-block read, straight to the caller
+				m = left - left % 512;
+				card.commands++;
+				card.sectors += m / 512;
+			} else {
+				if (cacheFile != f.get() || cacheSector != sector) {
+					card.commands++;
+					card.sectors++;
+					cacheFile = f.get();
+					cacheSector = sector;
+				}
+				m = min(left, 512 - offset);
+			}
+			memcpy(to, &f->data[p], m);
+			to += m;
+			p += m;
+			left -= m;
+		}
+		return n;
+	}
+	bool seek(uint64_t x) {
+		if (!f || x > f->data.size()) return false;
+		p = x;
+		return true;
+	}
+	uint64_t position() { return p; }
+	uint64_t size() { return f ? f->data.size() : 0; }
+	int available() { return f ? (int) std::min<uint64_t>(f->data.size() - p, 32767) : 0; }
+	void close() {
+		if (cacheFile == f.get()) cacheFile = NULL;
+		f.reset();
+	}
+	const char* name() { return f ? f->name.c_str() : ""; }
+	bool isDirectory() { return false; }
+	File openNextFile(uint8_t m = 0) { return File(); }
+	void rewindDirectory() {}
+	size_t write(const void*, size_t) { return 0; }
+	void flush() {}
+	bool getModifyTime(DateTimeFields&) { return true; }
+	bool getCreateTime(DateTimeFields&) { return true; }
+};
+
+class SDClass {
+public:
+	SdFs sdfs;
+	bool begin(int) { return true; }
+	File open(const char* n, uint8_t m = 0) {
+		auto it = simFiles.find(n);
+		if (it == simFiles.end()) return File();
+		// Reading the directory entry
+		card.commands++;
+		return File(it->second);
+	}
+	bool exists(const char* n) { return simFiles.count(n); }
+	bool remove(const char*) { return true; }
+	bool rename(const char*, const char*) { return true; }
+};
+extern SDClass SD;
@@ -0,0 +1,77 @@
+// Card commands and sectors for a player streaming 60 s of each format, through
+// prefetch() and update() as loop() and the audio interrupt would (user-017).
+// The card time is modelled for SPI at 24 MHz: 171 us to clock a sector out, and
+// about 100 us for each command to be sent, answered and its CRC read.
+// Compare with make card_bench BEFORE=user-017. The checksums show the audio
+// is the same.
+#include "SDPlayPCM.h"
+#include "host.h"
+
+#define SECTOR_US 171
+#define COMMAND_US 100
+#define SECONDS 60
+
+SDPlayPCM p;
+
+static uint64_t sum;
+
+static void addToSum() {
+	for (int c = 0; c < 2; c++) {
+		for (int16_t s : captured[c]) sum = sum * 31 + (uint16_t) s;
+		captured[c].clear();
+	}
+}
+
+int main() {
+	struct {
+		const char* name;
+		int rate, channels, bits, offset;
+		float speed;
+	} cases[] = {
+		{"44k 16 mono", 44100, 1, 16, 44, 1.0},
+		{"44k 16 stereo", 44100, 2, 16, 44, 1.0},
+		{"44k 16 stereo x1.37", 44100, 2, 16, 44, 1.37},
+		{"48k 24 stereo", 48000, 2, 24, 44, 1.0},
+		{"96k 24 mono", 96000, 1, 24, 68, 1.0},
+		{"96k 16 stereo x0.71", 96000, 2, 16, 44, 0.71},
+		{"44k float stereo", 44100, 2, 32, 80, 1.0},
+	};
+	printf("%-22s %8s %8s %9s %10s %8s %10s\n", "format", "reads", "commands", "sectors", "bytes/cmd", "card ms", "checksum");
+	for (auto& c : cases) {
+		int size = c.rate * SECONDS * c.channels * c.bits / 8;
+		char name[32];
+		snprintf(name, sizeof(name), "b%d_%d_%d", c.rate, c.channels, c.bits);
+		std::vector<uint8_t> data(c.offset + size);
+		srand(1);
+		for (auto& d : data) d = rand();
+		addFile(name, data);
+		AudioFileInfo info = fileInfo(name, c.channels, c.bits, c.rate);
+		info.size = size;
+		info.dataOffset = c.offset;
+		if (c.bits == 32) info.setFloat();
+
+		p.playbackSpeed = c.speed;
+		p.loopPlayback(false);
+		p.setInterpolation(INTERPOLATION_LINEAR);
+		p.underruns = 0;
+		p.stop();
+		card = CardStats();
+		captured[0].clear();
+		captured[1].clear();
+		p.playFrom(&info);
+		p.prefetch();
+		sum = 0;
+		for (int b = 0; b < 44100 * SECONDS / AUDIO_BLOCK_SAMPLES; b++) {
+			p.update();
+			p.prefetch();
+			if (p.hasFinished()) break;
+			if (captured[0].size() > 100000) addToSum();
+		}
+		addToSum();
+		double ms = (card.sectors * SECTOR_US + card.commands * COMMAND_US) / 1000.0;
+		printf("%-22s %8ld %8ld %9ld %10.0f %8.0f %010llx%s\n", c.name, card.calls, card.commands, card.sectors,
+			(double) card.bytes / card.commands, ms, (unsigned long long) (sum & 0xffffffffff), p.underruns ? "  underruns!" : "");
+		simFiles.erase(name);
+	}
+	return 0;
+}
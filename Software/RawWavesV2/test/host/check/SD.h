@@ -0,0 +1,41 @@
+#pragma once
+// Does nothing. For compiling every file of the sketch in make check, and
+// for harnesses that don't use the card.
+#include <Arduino.h>
+#include <sdfat_stub.h>
+
+#define FILE_READ 0
+#define FILE_WRITE 1
+#define O_RDONLY 0
+
+class File : public Print {
+public:
+	File() {}
+	operator bool() const { return true; }
+	int read() { return 0; }
+	int read(void*, size_t) { return 0; }
+	bool seek(uint64_t) { return true; }
+	uint64_t position() { return 0; }
+	uint64_t size() { return 0; }
+	int available() { return 0; }
+	void close() {}
+	const char* name() { return ""; }
+	bool isDirectory() { return false; }
+	File openNextFile(uint8_t m = 0) { return File(); }
+	void rewindDirectory() {}
+	size_t write(const void*, size_t) { return 0; }
+	void flush() {}
+	bool getModifyTime(DateTimeFields& t) { t = DateTimeFields(); return true; }
+	bool getCreateTime(DateTimeFields& t) { t = DateTimeFields(); return true; }
+};
+
+class SDClass {
+public:
+	SdFs sdfs;
+	bool begin(int) { return true; }
+	File open(const char*, uint8_t m = 0) { return File(); }
+	bool exists(const char*) { return true; }
+	bool remove(const char*) { return true; }
+	bool rename(const char*, const char*) { return true; }
+};
+extern SDClass SD;
@@ -0,0 +1,54 @@
+// Continue mode (user-012). A new file starts the same fraction of the way
+// through as the one it replaces. A file with an empty data chunk has no
+// fraction, so whatever follows it starts at 0. It starts at 0 itself, and
+// skips in it go to 0.
+#include "AudioEngine.h"
+#include "host.h"
+
+AudioFileInfo bank[3];
+Settings settings("settings.txt");
+AudioEngine engine;
+
+static void run(int blocks) {
+	for (int k = 0; k < blocks; k++) {
+		engine.update();
+		for (AudioEngine::Voice& voice : engine.voices) voice.player.update();
+	}
+}
+
+int main() {
+	int sizes[3] = {88200 * 2, 88200 * 4, 0};
+	for (int i = 0; i < 3; i++) {
+		std::vector<uint8_t> data(sizes[i]);
+		for (int k = 0; k < sizes[i]; k++) data[k] = k * 7 + i;
+		std::string name = "c" + std::to_string(i);
+		addFile(name.c_str(), data);
+		bank[i] = fileInfo(name.c_str(), 1, 16);
+	}
+	settings.looping = true;
+	settings.loopMode = LOOP_MODE_CONTINUE;
+	settings.hardSwap = false;
+	engine.init(settings);
+	engine.setBank(bank, 3);
+
+	engine.changeTo(&bank[0], 0);
+	run(200);
+	double fraction = (double) (engine.current->player.position() >> 32) / bank[0].getFrames();
+	engine.changeTo(&bank[1], 0);
+	double started = (double) bank[1].startPlayFrom / bank[1].getBytesPerFrame() / bank[1].getFrames();
+	printf("continue: %.4f of the way through, the next file starts at %.4f\n", fraction, started);
+	expect(fraction > 0.1 && fabs(started - fraction) < 0.001, "the next file starts the same fraction through");
+
+	engine.changeTo(&bank[2], 0);
+	run(10);
+	expect(bank[2].startPlayFrom == 0, "the empty file starts at 0");
+	engine.skipTo(512);
+	run(10);
+	expect(bank[2].startPlayFrom == 0, "a skip in the empty file goes to 0");
+	engine.changeTo(&bank[0], 0);
+	run(10);
+	printf("after the empty file: starts at %u\n", bank[0].startPlayFrom);
+	expect(bank[0].startPlayFrom == 0, "the file after the empty one starts at 0");
+
+	return result();
+}
@@ -0,0 +1,108 @@
+// The ring pool the voices share (user-004). Four 96k stereo files kept whole in
+// RAM fit the voice budgets, so all four have to play, each with a ring of its
+// own. Then 5000 random starts and skips over 8 formats, at speeds up to the
+// most allowed with sinc: every playing ring has to hold at least a block at full
+// speed, lie inside the pool and not overlap another.
+#include "AudioEngine.h"
+#include "host.h"
+
+AudioFileInfo bank[8];
+Settings settings("settings.txt");
+AudioEngine engine;
+
+static void makeFile(int i, uint32_t rate, int channels, int bits, int bytes) {
+	std::vector<uint8_t> data(bytes - bytes % (channels * bits / 8));
+	for (size_t k = 0; k < data.size(); k++) data[k] = k * 7 + i;
+	std::string name = "f" + std::to_string(i);
+	addFile(name.c_str(), data);
+	bank[i] = fileInfo(name.c_str(), channels, bits, rate);
+}
+
+// The smallest ring allocateRing() may give a file
+static uint32_t minimum(AudioFileInfo* info) {
+	uint32_t blockFrames = AUDIO_BLOCK_SAMPLES * MAX_PLAYBACK_SPEED * (float) (info->getSampleRate() / 44100.0);
+	return (blockFrames + 1 + RESAMPLE_REACH) * info->getBytesPerFrame() + RING_HISTORY + PREFETCH_MIN_READ;
+}
+
+static int playing() {
+	int n = 0;
+	for (int i = 0; i < MAX_VOICES; i++) n += engine.voices[i].player.isPlaying();
+	return n;
+}
+
+// Where each player's ring is in the pool
+struct HostTest {
+	static uint32_t ringOffset(SDPlayPCM& p) { return p.ringOffset; }
+	static uint32_t ringSize(SDPlayPCM& p) { return p.ringSize; }
+};
+
+// Checks the rings of the voices playing, and counts what's wrong
+static int checkRings() {
+	int bad = 0;
+	for (int a = 0; a < MAX_VOICES; a++) {
+		SDPlayPCM& pa = engine.voices[a].player;
+		if (!pa.isPlaying()) continue;
+		uint32_t startA = HostTest::ringOffset(pa), endA = startA + HostTest::ringSize(pa);
+		bad += !expect(endA - startA >= minimum(pa.playingFile()), "voice %d has a ring of %u, under %u", a + 1, endA - startA, minimum(pa.playingFile()));
+		bad += !expect(endA <= RING_POOL_SIZE, "voice %d's ring runs past the pool", a + 1);
+		for (int b = 0; b < a; b++) {
+			SDPlayPCM& pb = engine.voices[b].player;
+			uint32_t startB = HostTest::ringOffset(pb), endB = startB + HostTest::ringSize(pb);
+			bad += !expect(!pb.isPlaying() || startA >= endB || startB >= endA, "voices %d and %d share ring space", a + 1, b + 1);
+		}
+	}
+	return bad;
+}
+
+static void run(int blocks) {
+	for (int k = 0; k < blocks; k++) {
+		engine.update();
+		for (AudioEngine::Voice& voice : engine.voices) voice.player.update();
+	}
+}
+
+int main() {
+	for (int i = 0; i < 4; i++) makeFile(i, 96000, 2, 16, 40000);
+	settings.looping = true;
+	settings.hardSwap = false;
+	settings.ramFileKB = 64;
+	engine.init(settings);
+	engine.setBank(bank, 4);
+	run(2000);
+	for (int t = 0; t < 12; t++) {
+		engine.changeTo(&bank[t % 4], 0);
+		run(20);
+		expect(engine.current->player.isPlaying(), "start %d plays", t + 1);
+		checkRings();
+	}
+	printf("four whole 96k stereo files: %d voices playing\n", playing());
+	expect(playing() == 4, "all four play");
+
+	makeFile(0, 96000, 2, 16, 40000);
+	makeFile(1, 48000, 2, 32, 50000);
+	makeFile(2, 44100, 1, 16, 300000);
+	makeFile(3, 96000, 1, 24, 300000);
+	makeFile(4, 22050, 2, 8, 30000);
+	makeFile(5, 96000, 2, 16, 900000);
+	makeFile(6, 48000, 2, 24, 60000);
+	makeFile(7, 44100, 2, 16, 700000);
+	settings.interpolation = INTERPOLATION_SINC;
+	engine.init(settings);
+	engine.setBank(bank, 8);
+	srand(3);
+	int notPlaying = 0, bad = 0;
+	float speeds[] = {0.5, 1, 2, 3.5, MAX_PLAYBACK_SPEED};
+	for (int t = 0; t < 5000; t++) {
+		engine.setPlaybackSpeed(speeds[rand() % 5]);
+		if (rand() % 3) engine.changeTo(&bank[rand() % 8], rand() % 1024);
+		else engine.skipTo(rand() % 1024);
+		notPlaying += !engine.current->player.isPlaying();
+		run(rand() % 30);
+		bad += checkRings();
+	}
+	int underruns = 0;
+	for (AudioEngine::Voice& voice : engine.voices) underruns += voice.player.underruns;
+	printf("5000 random starts: %d didn't play, %d ring problems, %d underruns\n", notPlaying, bad, underruns);
+	expect(notPlaying == 0 && underruns == 0, "every start plays without underruns");
+	return result();
+}
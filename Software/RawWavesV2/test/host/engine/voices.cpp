@@ -0,0 +1,96 @@
+// The voice pool (user-016). Retriggers take a new voice each time until all are
+// playing, then steal the oldest. Two 96k stereo files are the most the card
+// budget allows at once, and the voice stolen to keep to it fades out over
+// DECLICK_MS. Hard swap leaves one voice playing.
+#include "AudioEngine.h"
+#include "host.h"
+
+AudioFileInfo bank[4];
+Settings settings("settings.txt");
+AudioEngine engine;
+
+static int playing() {
+	int n = 0;
+	for (int i = 0; i < MAX_VOICES; i++) n += engine.voices[i].player.isPlaying();
+	return n;
+}
+
+static int stolen() {
+	int n = 0;
+	for (int i = 0; i < MAX_VOICES; i++) n += engine.voices[i].player.isPlaying() && engine.voices[i].stolen;
+	return n;
+}
+
+int main() {
+	struct { uint32_t rate; int channels; int bytes; } formats[4] = {
+		{44100, 1, 400000}, {44100, 1, 400000}, {96000, 2, 4000000}, {96000, 2, 4000000},
+	};
+	for (int i = 0; i < 4; i++) {
+		std::vector<uint8_t> data(formats[i].bytes);
+		for (int k = 0; k < formats[i].bytes; k++) data[k] = k * 7 + i;
+		std::string name = "f" + std::to_string(i);
+		addFile(name.c_str(), data);
+		bank[i] = fileInfo(name.c_str(), formats[i].channels, 16, formats[i].rate);
+	}
+	settings.looping = false;
+	settings.hardSwap = false;
+	settings.ramFileKB = 0;
+	engine.init(settings);
+	engine.setBank(bank, 4);
+
+	engine.changeTo(&bank[0], 0);
+	engine.update();
+	for (int t = 0; t < 6; t++) {
+		engine.skipTo(0);
+		engine.update();
+		printf("retrigger %d: %d playing, on voice %d\n", t + 1, playing(), engine.current->player.playerID);
+		expect(playing() == min(t + 2, MAX_VOICES), "retrigger %d takes a new voice while there is one", t + 1);
+	}
+
+	// With all of them playing, the next retrigger takes the one started first
+	AudioEngine::Voice* oldest = &engine.voices[0];
+	for (AudioEngine::Voice& voice : engine.voices) {
+		if (voice.started < oldest->started) oldest = &voice;
+	}
+	engine.skipTo(0);
+	expect(engine.current == oldest, "the oldest voice is stolen");
+
+	settings.releaseTime = 1000;
+	engine.changeTo(&bank[2], 0);
+	simMillis += 10;
+	engine.update();
+	engine.changeTo(&bank[3], 0);
+	simMillis += 10;
+	engine.update();
+	engine.skipTo(0);
+	printf("96k stereo: %d playing, %d of them stolen and fading\n", playing(), stolen());
+	expect(playing() - stolen() == 2 && stolen() == 1, "two 96k stereo files fit the card budget, and one more fades");
+	simMillis += DECLICK_MS + 1;
+	engine.update();
+	printf("after %d ms: %d playing, %d fading\n", DECLICK_MS + 1, playing(), stolen());
+	expect(playing() == 2 && stolen() == 0, "the stolen voice stops after DECLICK_MS");
+
+	// A file that can't be opened. Its voice fails to start again on the next
+	// retrigger, and the voices still ringing out aren't stopped for it.
+	AudioFileInfo missing = bank[0];
+	setName(missing, "missing");
+	settings.releaseTime = 1000;
+	engine.changeTo(&bank[0], 0);
+	engine.skipTo(0);
+	engine.skipTo(0);
+	engine.changeTo(&missing, 0);
+	for (int k = 0; k < 4; k++) {
+		engine.update();
+		for (AudioEngine::Voice& voice : engine.voices) voice.player.update();
+	}
+	int before = playing();
+	for (int t = 0; t < 4; t++) engine.skipTo(0);
+	printf("missing file: %d playing before the retriggers, %d after\n", before, playing());
+	expect(before == 3 && playing() == 3, "a file that can't be opened doesn't stop the other voices");
+
+	settings.hardSwap = true;
+	engine.changeTo(&bank[0], 0);
+	printf("hard swap: %d playing\n", playing());
+	expect(playing() == 1, "hard swap leaves one voice");
+	return result();
+}
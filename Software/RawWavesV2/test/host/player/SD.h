@@ -0,0 +1,76 @@
+#pragma once
+// Files held in memory for the player harnesses. Counts card operations.
+#include <Arduino.h>
+#include <sdfat_stub.h>
+#include <vector>
+#include <map>
+#include <memory>
+
+#define FILE_READ 0
+#define FILE_WRITE 1
+#define O_RDONLY 0
+
+// Opens, reads and seeks, and seeks alone
+inline int sdOps = 0;
+inline int sdSeeks = 0;
+
+struct SimFile {
+	std::string name;
+	std::vector<uint8_t> data;
+};
+extern std::map<std::string, std::shared_ptr<SimFile>> simFiles;
+
+class File : public Print {
+public:
+	std::shared_ptr<SimFile> f;
+	uint64_t p = 0;
+	File() {}
+	File(std::shared_ptr<SimFile> x) : f(x) {}
+	operator bool() const { return (bool) f; }
+	int read() {
+		if (!f || p >= f->data.size()) return -1;
+		return f->data[p++];
+	}
+	int read(void* b, size_t n) {
+		sdOps++;
+		if (!f) return -1;
+		n = min(n, (size_t) (f->data.size() - p));
+		if (n > 0) memcpy(b, &f->data[p], n);
+		p += n;
+		return n;
+	}
+	bool seek(uint64_t x) {
+		sdOps++;
+		sdSeeks++;
+		if (!f || x > f->data.size()) return false;
+		p = x;
+		return true;
+	}
+	uint64_t position() { return p; }
+	uint64_t size() { return f ? f->data.size() : 0; }
+	int available() { return f ? (int) std::min<uint64_t>(f->data.size() - p, 32767) : 0; }
+	void close() { f.reset(); }
+	const char* name() { return f ? f->name.c_str() : ""; }
+	bool isDirectory() { return false; }
+	File openNextFile(uint8_t m = 0) { return File(); }
+	void rewindDirectory() {}
+	size_t write(const void*, size_t) { return 0; }
+	void flush() {}
+	bool getModifyTime(DateTimeFields&) { return true; }
+	bool getCreateTime(DateTimeFields&) { return true; }
+};
+
+class SDClass {
+public:
+	SdFs sdfs;
+	bool begin(int) { return true; }
+	File open(const char* n, uint8_t m = 0) {
+		sdOps++;
+		auto it = simFiles.find(n);
+		return it == simFiles.end() ? File() : File(it->second);
+	}
+	bool exists(const char* n) { return simFiles.count(n); }
+	bool remove(const char*) { return true; }
+	bool rename(const char*, const char*) { return true; }
+};
+extern SDClass SD;
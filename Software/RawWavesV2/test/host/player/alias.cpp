@@ -0,0 +1,82 @@
+// What the interpolation modes let alias (user-008). A sine is played from a
+// 96k or 88.2k file, or pitched up from a 44.1k one, so it lands above half the
+// output rate. The level where it folds back is measured with a windowed DFT, in
+// dB against the sine. Sinc has to keep it down. A 1 kHz tone is also measured,
+// to see that sinc leaves the passband alone.
+#include "SDPlayPCM.h"
+#include "host.h"
+
+#define AMPLITUDE 16000.0
+#define SAMPLES 16384
+
+SDPlayPCM p;
+
+static const char* modeNames[] = {"none", "linear", "hermite", "sinc"};
+
+// Level of frequency in what was captured, in dB against AMPLITUDE
+static double level(double frequency) {
+	double re = 0, im = 0, weight = 0;
+	for (int i = 0; i < SAMPLES; i++) {
+		double w = 0.5 - 0.5 * cos(2 * M_PI * i / SAMPLES);
+		double a = 2 * M_PI * frequency * i / 44100;
+		re += w * captured[0][1024 + i] * cos(a);
+		im += w * captured[0][1024 + i] * sin(a);
+		weight += w;
+	}
+	return 20 * log10(2 * sqrt(re * re + im * im) / weight / AMPLITUDE + 1e-12);
+}
+
+// Plays a sine of tone Hz from a file at rate, and returns the level at measure Hz
+static double play(uint32_t rate, double tone, float speed, int interpolation, double measure) {
+	static int files = 0;
+	int frames = (SAMPLES + 2048) * speed * rate / 44100 + 64;
+	std::vector<uint8_t> data;
+	for (int i = 0; i < frames; i++) {
+		int16_t v = lround(AMPLITUDE * sin(2 * M_PI * tone * i / rate));
+		data.push_back(v & 255);
+		data.push_back((v >> 8) & 255);
+	}
+	std::string name = "a" + std::to_string(files++);
+	addFile(name.c_str(), data);
+	AudioFileInfo info = fileInfo(name.c_str(), 1, 16, rate);
+
+	captured[0].clear();
+	p.loopPlayback(false);
+	p.setInterpolation(interpolation);
+	p.playbackSpeed = speed;
+	p.playFrom(&info);
+	p.prefetch();
+	while (captured[0].size() < 1024 + SAMPLES) {
+		p.update();
+		p.prefetch();
+	}
+	return level(measure);
+}
+
+int main() {
+	struct { uint32_t rate; double tone; float speed; } cases[] = {
+		{96000, 30000, 1.0}, {88200, 30000, 1.0}, {44100, 15000, 2.0}, {44100, 8600, 3.5},
+	};
+	printf("%-30s", "alias, dB");
+	for (const char* name : modeNames) printf("%9s", name);
+	printf("\n");
+	for (auto& c : cases) {
+		// The sine plays at tone * speed, and folds back about 22050 Hz
+		double played = c.tone * c.speed;
+		double alias = fabs(44100 * round(played / 44100) - played);
+		printf("%5u Hz, %5.0f Hz at %.1fx -> %5.0f", c.rate, c.tone, c.speed, alias);
+		double db[4];
+		for (int mode = INTERPOLATION_NONE; mode <= INTERPOLATION_SINC; mode++) {
+			db[mode] = play(c.rate, c.tone, c.speed, mode, alias);
+			printf("%9.1f", db[mode]);
+		}
+		printf("\n");
+		expect(db[INTERPOLATION_SINC] < -60, "%u Hz at %.1fx, sinc lets the alias through at %.1f dB", c.rate, c.speed, db[INTERPOLATION_SINC]);
+	}
+	for (uint32_t rate : {44100, 48000, 96000}) {
+		double db = play(rate, 1000, 1.0, INTERPOLATION_SINC, 1000);
+		printf("1 kHz from %u Hz through sinc: %+.3f dB\n", rate, db);
+		expect(fabs(db) < 0.05, "1 kHz from %u Hz is %+.3f dB", rate, db);
+	}
+	return result();
+}
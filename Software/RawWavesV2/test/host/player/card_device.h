@@ -0,0 +1,101 @@
+#pragma once
+// A card behind SDReader's SectorDevice, holding files added with addFile() one
+// after another. It takes a random number of polls to send each data start token
+// and to finish each DMA transfer. It can send an error token for one sector and
+// a wrong CRC for another.
+#include "SDReader.h"
+#include "host.h"
+
+class CardDevice : public SectorDevice {
+public:
+	std::vector<uint8_t> disk;
+	// First sector of each file placed
+	std::map<std::string, uint32_t> firstSectors;
+	uint32_t errorSector = ~0u;
+	uint32_t badCrcSector = ~0u;
+	int commands = 0;
+	bool open = false;
+
+	// Puts a file on the card, from the start of a sector. Returns that sector.
+	uint32_t place(const char* name) {
+		uint32_t first = disk.size() / SD_SECTOR + 1;
+		disk.resize(first * SD_SECTOR, 0);
+		std::vector<uint8_t>& data = simFiles[name]->data;
+		disk.insert(disk.end(), data.begin(), data.end());
+		disk.resize((disk.size() + SD_SECTOR - 1) / SD_SECTOR * SD_SECTOR, 0);
+		firstSectors[name] = first;
+		return first;
+	}
+
+	bool readStart(uint32_t sector) {
+		expect(!open, "a read started while one was open");
+		if (sector * SD_SECTOR >= disk.size()) return false;
+		commands++;
+		current = sector;
+		stage = 0;
+		delay = rand() % 5;
+		open = true;
+		return true;
+	}
+
+	uint8_t receiveByte() {
+		if (stage == 0) {
+			if (delay > 0) {
+				delay--;
+				return 0xFF;
+			}
+			if (current == errorSector) return 0x0D;
+			stage = 1;
+			return SD_DATA_START;
+		}
+		if (stage == 2) {
+			// The two CRC bytes after a sector, high first
+			uint16_t value = crc16(&disk[current * SD_SECTOR]) ^ (current == badCrcSector ? 0x0100 : 0);
+			uint8_t b = crcBytes == 0 ? value >> 8 : value;
+			if (++crcBytes == 2) {
+				crcBytes = 0;
+				stage = 0;
+				current++;
+				delay = rand() % 5;
+			}
+			return b;
+		}
+		return 0xAA;
+	}
+
+	bool receive(uint8_t* data, uint16_t count) {
+		if (!expect(stage == 1 && count == SD_SECTOR, "a sector was received out of turn")) return false;
+		to = data;
+		dmaPolls = rand() % 4;
+		return true;
+	}
+
+	bool done() {
+		if (stage != 1) return true;
+		if (dmaPolls-- > 0) return false;
+		if (!expect((current + 1) * SD_SECTOR <= disk.size(), "a read ran off the card")) return true;
+		memcpy(to, &disk[current * SD_SECTOR], SD_SECTOR);
+		stage = 2;
+		return true;
+	}
+
+	bool readStop() {
+		open = false;
+		return true;
+	}
+
+	// A bit at a time, as the SD spec gives it
+	static uint16_t crc16(const uint8_t* data) {
+		uint16_t crc = 0;
+		for (int i = 0; i < SD_SECTOR; i++) {
+			crc ^= data[i] << 8;
+			for (int bit = 0; bit < 8; bit++) crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+		return crc;
+	}
+
+private:
+	uint32_t current = 0;
+	int stage = 0, delay = 0, dmaPolls = 0, crcBytes = 0;
+	uint8_t* to = NULL;
+};
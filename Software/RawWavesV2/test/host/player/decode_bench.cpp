@@ -0,0 +1,132 @@
+// Time taken by update() to decode a block. Best of 5 runs of 20000 blocks, from
+// a looping file so the ring wraps. Each section is the benchmark of a request:
+//
+//   phase    (user-001) drop sample at 0.5x, 1x, 1.37x and 4x
+//   kernels  (user-002, user-009) every interpolation up to the 3.56x and 4.49x speed caps
+//   stereo   (user-005, user-011) 24 bit, and 48k 24 bit stereo in each stereo mode
+//   rates    (user-008) 16 bit mono at each sample rate, drop sample and sinc
+//
+// It builds against every tree, skipping what the tree's player can't do yet.
+// For the other half of a comparison, e.g. the float phase against the fixed
+// point one, make decode_bench BEFORE=user-001.
+#include "SDPlayPCM.h"
+#include "host.h"
+#include <chrono>
+
+SDPlayPCM p;
+
+// INTERPOLATION_NONE to INTERPOLATION_SINC
+static const char* modeNames[] = {"drop sample", "linear", "hermite", "sinc"};
+// STEREO_MODE_STEREO to STEREO_MODE_MONO
+static const char* stereoNames[] = {"stereo", "left", "mixed"};
+
+// Calls that came with later requests. Without them only the defaults can be timed.
+template<class P> static auto prefetch(P& p, int) -> decltype(p.prefetch()) { p.prefetch(); }
+template<class P> static void prefetch(P&, long) {}
+template<class P> static auto interpolate(P& p, int mode, int) -> decltype(p.setInterpolation(0), bool()) {
+	p.setInterpolation(mode);
+	return true;
+}
+template<class P> static bool interpolate(P&, int mode, long) { return mode == 0; }
+template<class P> static auto stereoMode(P& p, int mode, int) -> decltype(p.setStereoMode(0), bool()) {
+	p.setStereoMode(mode);
+	return true;
+}
+template<class P> static bool stereoMode(P&, int mode, long) { return mode == 0; }
+template<class P> static auto underruns(P& p, int) -> decltype((int) p.underruns) { return p.underruns; }
+template<class P> static int underruns(P&, long) { return 0; }
+
+static void bench(const char* name, int channels, int bits, float speed, int interpolation,
+		int stereo = 0, uint32_t sampleRate = 44100) {
+	AudioFileInfo info = fileInfo(name, channels, bits, sampleRate);
+	// Before user-008 only a few rates could be set
+	if (info.getSampleRate() != sampleRate) return;
+	if (!interpolate(p, interpolation, 0) || !stereoMode(p, stereo, 0)) return;
+	p.loopPlayback(true);
+	p.playbackSpeed = speed;
+	int before = underruns(p, 0);
+	p.playFrom(&info);
+	prefetch(p, 0);
+	double best = 1e9;
+	for (int run = 0; run < 5; run++) {
+		double total = 0;
+		for (int b = 0; b < 20000; b++) {
+			prefetch(p, 0);
+			captured[0].clear();
+			captured[1].clear();
+			auto start = std::chrono::steady_clock::now();
+			p.update();
+			total += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		}
+		best = min(best, total / 20000);
+	}
+	char format[40];
+	snprintf(format, sizeof(format), "%2d bit %s %5.1fk", bits, channels == 2 ? stereoNames[stereo] : "mono", sampleRate / 1000.0);
+	printf("  %-22s %.2fx  %-12s %6.0f ns per block%s\n", format, speed, modeNames[interpolation], best,
+		underruns(p, 0) != before ? "  underruns!" : "");
+}
+
+static void add24(const char* name, int channels) {
+	std::vector<uint8_t> data;
+	for (int i = 0; i < 441000 * channels; i++) {
+		int v = i * 77;
+		data.push_back(v & 255);
+		data.push_back((v >> 8) & 255);
+		data.push_back((v >> 16) & 255);
+	}
+	addFile(name, data);
+}
+
+int main() {
+	// 10 s of a sawtooth
+	std::vector<uint8_t> data;
+	for (int i = 0; i < 441000; i++) {
+		int16_t v = i * 7;
+		data.push_back(v & 255);
+		data.push_back((v >> 8) & 255);
+	}
+	addFile("m16", data);
+	add24("m24", 1);
+	add24("s24", 2);
+	// The player keeps to a file it knows, so each format has a name of its own
+	add24("s24 48k", 2);
+	const uint32_t rates[] = {8000, 11025, 16000, 22050, 32000, 44100, 48000, 88200, 96000};
+	for (uint32_t rate : rates) addFile(("m16 " + std::to_string(rate)).c_str(), data);
+
+	printf("phase\n");
+	for (float speed : {0.5f, 1.0f, 1.37f, 4.0f}) {
+		bench("m16", 1, 16, speed, 0);
+		bench("m24", 1, 24, speed, 0);
+	}
+
+	printf("kernels\n");
+	for (float speed : {1.0f, 1.37f, 3.56f, 4.49f}) {
+		for (int interpolation = 0; interpolation <= 3; interpolation++) {
+			bench("m16", 1, 16, speed, interpolation);
+		}
+	}
+	for (float speed : {3.56f, 4.49f}) {
+		for (int interpolation = 0; interpolation <= 3; interpolation++) {
+			bench("m24", 1, 24, speed, interpolation);
+		}
+	}
+
+	printf("stereo\n");
+	for (float speed : {1.0f, 1.37f}) {
+		bench("m24", 1, 24, speed, 0);
+		bench("s24", 2, 24, speed, 0);
+	}
+	for (int stereo = 0; stereo <= 2; stereo++) {
+		for (int interpolation : {0, 3}) {
+			bench("s24 48k", 2, 24, 1.0f, interpolation, stereo, 48000);
+		}
+	}
+
+	printf("rates\n");
+	for (uint32_t rate : rates) {
+		for (int interpolation : {0, 3}) {
+			bench(("m16 " + std::to_string(rate)).c_str(), 1, 16, 1.0f, interpolation, 0, rate);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,96 @@
+// The head cache (user-014). Files of every width, channel count and a few rates
+// are played with and without the cache, across loops. The audio has to be the
+// same, and with the cache filled a start can't touch the card before its first
+// block. In radio mode, on a bank of 44k 16 bit files, the channels either side
+// get windows at their radio position. These have to be there, move on with it
+// and play the same audio.
+#include "SDPlayPCM.h"
+#include "HeadCache.h"
+#include "host.h"
+
+#define FILES 6
+#define RADIO_FILES 4
+
+AudioFileInfo infos[FILES];
+AudioFileInfo radioInfos[RADIO_FILES];
+SDPlayPCM p;
+HeadCache cache;
+
+// Both outputs for 150 blocks from byte from. opsBefore is the card operations before the first block.
+static std::vector<int16_t> play(AudioFileInfo& info, uint32_t from, bool useCache, int* opsBefore) {
+	p.setCache(useCache ? &cache : NULL);
+	info.startPlayFrom = from;
+	captured[0].clear();
+	captured[1].clear();
+	p.stop();
+	p.playFrom(&info);
+	sdOps = 0;
+	p.prefetch();
+	*opsBefore = sdOps;
+	for (int b = 0; b < 150; b++) {
+		p.update();
+		p.prefetch();
+	}
+	std::vector<int16_t> out = captured[0];
+	out.insert(out.end(), captured[1].begin(), captured[1].end());
+	return out;
+}
+
+int main() {
+	struct { int channels, bits; uint32_t rate, frames; } formats[FILES] = {
+		{1, 16, 44100, 9001}, {2, 16, 44100, 20000}, {1, 24, 48000, 7777},
+		{2, 24, 48000, 6001}, {1, 16, 22050, 3001}, {2, 8, 44100, 12000},
+	};
+	srand(3);
+	for (int i = 0; i < FILES; i++) {
+		std::vector<uint8_t> data(formats[i].frames * formats[i].channels * formats[i].bits / 8);
+		for (uint8_t& b : data) b = rand();
+		std::string name = "f" + std::to_string(i);
+		addFile(name.c_str(), data);
+		infos[i] = fileInfo(name.c_str(), formats[i].channels, formats[i].bits, formats[i].rate);
+	}
+	p.loopPlayback(true);
+	cache.setBank(infos, FILES, false);
+	for (int k = 0; k < 2000; k++) cache.update(0);
+	printf("%d ms of each file cached\n", cache.headMs);
+
+	for (int i = 0; i < FILES; i++) {
+		int opsWithout, opsWith;
+		std::vector<int16_t> without = play(infos[i], 0, false, &opsWithout);
+		std::vector<int16_t> with = play(infos[i], 0, true, &opsWith);
+		printf("%d ch %2d bit %5u Hz: card operations before the first block %d without the cache, %d with\n",
+			formats[i].channels, formats[i].bits, formats[i].rate, opsWithout, opsWith);
+		expect(with == without, "file %d, the same audio with the cache", i);
+		expect(opsWith == 0, "file %d, %d card operations before the first block", i, opsWith);
+	}
+
+	// Ten second files, so the radio positions are well past the heads
+	for (int i = 0; i < RADIO_FILES; i++) {
+		int channels = 1 + i % 2;
+		std::vector<uint8_t> data(441000 * channels * 2);
+		for (uint8_t& b : data) b = rand();
+		std::string name = "r" + std::to_string(i);
+		addFile(name.c_str(), data);
+		radioInfos[i] = fileInfo(name.c_str(), channels, 16);
+	}
+	cache.setBank(radioInfos, RADIO_FILES, true);
+	cache.setChannel(&radioInfos[2]);
+	// The neighbours of channel 2, and again once the radio position has moved on
+	for (uint64_t radioMicros : {3000000, 6000000}) {
+		for (int k = 0; k < 2000; k++) cache.update(radioMicros);
+		for (int i : {1, 3}) {
+			const unsigned char* data;
+			uint32_t from = radioInfos[i].frameAt(radioMicros + RADIO_CACHE_LEAD_MS * 1000) * radioInfos[i].getBytesPerFrame();
+			uint32_t cached = cache.find(&radioInfos[i], from, &data);
+			printf("radio window for file %d at byte %7u: %u bytes\n", i, from, cached);
+			expect(cached > 0, "file %d has a radio window at its radio position", i);
+			int opsWithout, opsWith;
+			std::vector<int16_t> without = play(radioInfos[i], from, false, &opsWithout);
+			std::vector<int16_t> with = play(radioInfos[i], from, true, &opsWith);
+			expect(with == without, "file %d, the same audio from the radio window", i);
+			expect(opsWith == 0, "file %d, %d card operations before the first block from the radio window", i, opsWith);
+		}
+	}
+	printf("hits %d, misses %d\n", cache.hits, cache.misses);
+	return result();
+}
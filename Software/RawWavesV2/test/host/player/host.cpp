@@ -0,0 +1,60 @@
+#include <SPI.h>
+#include <AudioStream.h>
+#include "host.h"
+
+std::map<std::string, std::shared_ptr<SimFile>> simFiles;
+SDClass SD;
+SerialC Serial;
+SPIC SPI;
+volatile uint32_t ARM_DWT_CYCCNT;
+
+uint32_t simMillis = 0;
+uint32_t millis() { return simMillis; }
+uint32_t micros() { return 0; }
+void delay(uint32_t) {}
+void AudioMemory(int) {}
+
+std::vector<int16_t> captured[2];
+static audio_block_t blocks[8];
+static int nextBlock = 0;
+
+audio_block_t* AudioStream::allocate() { return &blocks[nextBlock++ % 8]; }
+void AudioStream::release(audio_block_t*) {}
+void AudioStream::transmit(audio_block_t* b, unsigned char index) {
+	captured[index].insert(captured[index].end(), b->data, b->data + AUDIO_BLOCK_SAMPLES);
+}
+audio_block_t* AudioStream::receiveReadOnly(unsigned) { return 0; }
+audio_block_t* AudioStream::receiveWritable(unsigned) { return 0; }
+
+std::shared_ptr<SimFile> addFile(const char* name, const std::vector<uint8_t>& data) {
+	auto f = std::make_shared<SimFile>();
+	f->name = name;
+	f->data = data;
+	simFiles[name] = f;
+	return f;
+}
+
+AudioFileInfo fileInfo(const char* name, int channels, int bits, uint32_t sampleRate) {
+	AudioFileInfo info;
+	setName(info, name);
+	info.size = simFiles[name]->data.size();
+	info.setChannels(channels);
+	info.setBitsPerSample(bits);
+	info.setSampleRate(sampleRate);
+	return info;
+}
+
+int failures = 0;
+
+bool expect(bool ok, const char* format, ...) {
+	if (!ok) {
+		failures++;
+		printf("FAIL: ");
+		va_list args;
+		va_start(args, format);
+		vprintf(format, args);
+		va_end(args);
+		printf("\n");
+	}
+	return ok;
+}
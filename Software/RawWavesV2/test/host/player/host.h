@@ -0,0 +1,37 @@
+#pragma once
+// What the player harnesses share: files in memory, the blocks the players
+// transmit and a count of failed checks.
+#include <SD.h>
+#include <cstdio>
+#include <cstdarg>
+#include "AudioFileInfo.h"
+
+// Every block the players transmitted, per output
+extern std::vector<int16_t> captured[2];
+
+// A file with these bytes, replacing any of the same name
+std::shared_ptr<SimFile> addFile(const char* name, const std::vector<uint8_t>& data);
+
+// The name, size and format of a file added with addFile()
+AudioFileInfo fileInfo(const char* name, int channels, int bits, uint32_t sampleRate = 44100);
+
+// Names moved into a pool in user-022. Harnesses that benchmark older trees set
+// them through this.
+inline void setName(AudioFileInfo& info, const char* name) {
+#if __has_include("NamePool.h")
+	fileNames.start(NULL, name);
+	info.nameOffset = fileNames.keep();
+#else
+	info.name = name;
+#endif
+}
+
+// Prints a failure and counts it when ok is false
+extern int failures;
+bool expect(bool ok, const char* format, ...);
+
+// Exit status for main()
+inline int result() {
+	if (failures) printf("%d failed\n", failures);
+	return failures ? 1 : 0;
+}
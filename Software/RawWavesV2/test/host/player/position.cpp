@@ -0,0 +1,54 @@
+// The frame position a player reports (user-012). Each frame of a looping ramp
+// holds its own index. After every block, position() has to be the frame the
+// next block starts on, for mono and stereo, slow and fast, with skips and
+// across loop wraps.
+#include "SDPlayPCM.h"
+#include "host.h"
+
+#define FRAMES 3001
+
+SDPlayPCM p;
+
+static void run(int channels, float speed, uint32_t skip) {
+	static int files = 0;
+	std::vector<uint8_t> data;
+	for (int i = 0; i < FRAMES; i++) {
+		for (int c = 0; c < channels; c++) {
+			data.push_back(i & 255);
+			data.push_back((i >> 8) & 255);
+		}
+	}
+	// A new name each time, so the player doesn't keep the last file's data
+	std::string name = "m" + std::to_string(files++);
+	addFile(name.c_str(), data);
+	AudioFileInfo info = fileInfo(name.c_str(), channels, 16);
+	info.startPlayFrom = skip;
+
+	captured[0].clear();
+	p.loopPlayback(true);
+	p.playbackSpeed = speed;
+	p.underruns = 0;
+	p.playFrom(&info);
+	uint32_t next = skip / (2 * channels);
+	long bad = (p.position() >> 32) != next;
+	p.prefetch();
+	for (int b = 0; b < 300; b++) {
+		size_t from = captured[0].size();
+		p.update();
+		if (captured[0].size() > from && (uint16_t) captured[0][from] != next) bad++;
+		next = p.position() >> 32;
+		p.prefetch();
+	}
+	expect(bad == 0 && p.underruns == 0, "%d channels at %.2fx from byte %u: %ld blocks started off their position, %d underruns",
+		channels, speed, skip, bad, p.underruns);
+}
+
+int main() {
+	for (int channels = 1; channels <= 2; channels++) {
+		for (float speed : {1.0f, 0.37f, 1.37f, 2.9f}) {
+			for (uint32_t skip : {0u, 1000u, 4444u}) run(channels, speed, skip);
+		}
+	}
+	printf("24 cases\n");
+	return result();
+}
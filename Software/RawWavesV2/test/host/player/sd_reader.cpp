@@ -0,0 +1,119 @@
+// The DMA sector reader (user-018), against a card that takes its time. 800
+// queued requests have to complete in order with the right data, a full queue
+// has to refuse more. An error token or a wrong CRC has to fail only its own
+// request and leave the card stopped. A player at 1.23x, skipping every 100 blocks, has to
+// give the same audio with and without the reader, with no underruns.
+#include "SDPlayPCM.h"
+#include "card_device.h"
+
+CardDevice card;
+SDReader reader;
+SDPlayPCM p;
+
+std::vector<int> order;
+std::vector<bool> oks;
+
+static void completed(void* context, bool ok) {
+	order.push_back((int) (intptr_t) context);
+	oks.push_back(ok);
+}
+
+int main() {
+	srand(5);
+	std::vector<uint8_t> a(200000), w(300044);
+	for (uint8_t& b : a) b = rand();
+	for (uint8_t& b : w) b = rand();
+	addFile("a", a);
+	addFile("w", w);
+	uint32_t first = card.place("a");
+	card.place("w");
+	reader.begin(&card);
+
+	static uint8_t buffers[SD_READ_QUEUE][8 * SD_SECTOR];
+	for (int round = 0; round < 200; round++) {
+		order.clear();
+		oks.clear();
+		int counts[SD_READ_QUEUE];
+		uint32_t sectors[SD_READ_QUEUE];
+		for (int i = 0; i < SD_READ_QUEUE; i++) {
+			counts[i] = 1 + rand() % 8;
+			sectors[i] = first + rand() % 300;
+			expect(reader.read(sectors[i], counts[i], buffers[i], completed, (void*) (intptr_t) i), "round %d, request %d queued", round, i);
+		}
+		expect(!reader.read(first, 1, buffers[0], completed, NULL), "round %d, a full queue refuses a request", round);
+		for (int polls = 0; !reader.idle() && polls < 100000; polls++) reader.poll();
+		expect(order == std::vector<int>({0, 1, 2, 3}), "round %d, requests complete in order", round);
+		for (int i = 0; i < SD_READ_QUEUE; i++) {
+			expect(oks[i] && memcmp(buffers[i], &card.disk[sectors[i] * SD_SECTOR], counts[i] * SD_SECTOR) == 0,
+				"round %d, request %d has the right data", round, i);
+		}
+	}
+	printf("%d requests: %u sectors in %d read commands, %d errors\n", 200 * SD_READ_QUEUE, reader.sectors, card.commands, reader.errors);
+
+	card.errorSector = first + 3;
+	order.clear();
+	oks.clear();
+	reader.read(first, 6, buffers[0], completed, (void*) 0);
+	reader.read(first + 10, 2, buffers[1], completed, (void*) 1);
+	while (!reader.idle()) reader.poll();
+	expect(!oks[0] && oks[1] && !card.open, "an error token fails its own request only, and stops the card");
+	card.errorSector = ~0u;
+
+	// The SD spec's example, a sector of 0xFF has the CRC 0x7FA1
+	uint8_t ones[SD_SECTOR];
+	memset(ones, 0xFF, SD_SECTOR);
+	expect(SDReader::sectorCrc(ones) == 0x7FA1 && CardDevice::crc16(ones) == 0x7FA1, "the CRC of a sector of 0xFF is 0x7FA1");
+	for (int i = 0; i < 1000; i++) {
+		uint32_t sector = first + rand() % 300;
+		expect(SDReader::sectorCrc(&card.disk[sector * SD_SECTOR]) == CardDevice::crc16(&card.disk[sector * SD_SECTOR]), "sector %u's CRC", sector);
+	}
+	card.badCrcSector = first + 4;
+	order.clear();
+	oks.clear();
+	reader.read(first + 2, 4, buffers[0], completed, (void*) 0);
+	reader.read(first + 10, 2, buffers[1], completed, (void*) 1);
+	while (!reader.idle()) reader.poll();
+	printf("a wrong CRC: %u CRC errors, %u failed requests\n", reader.crcErrors, reader.errors);
+	expect(!oks[0] && oks[1] && !card.open && reader.crcErrors == 1, "a wrong CRC fails its own request only, and stops the card");
+	card.badCrcSector = ~0u;
+
+	// 16 bit stereo after a 45 byte header
+	AudioFileInfo info = fileInfo("w", 2, 16);
+	info.dataOffset = 45;
+	info.size = 299996;
+	info.firstSector = card.firstSectors["w"];
+	AudioFileInfo other = fileInfo("a", 1, 16);
+	std::vector<int16_t> out[2];
+	int calls[2], seeks[2];
+	for (int pass = 0; pass < 2; pass++) {
+		srand(9);
+		p.setReader(pass ? &reader : NULL);
+		p.playbackSpeed = 1.23;
+		p.setInterpolation(INTERPOLATION_LINEAR);
+		p.loopPlayback(true);
+		p.underruns = 0;
+		p.playFrom(&other);
+		p.stop();
+		captured[0].clear();
+		info.startPlayFrom = 0;
+		p.playFrom(&info);
+		sdOps = 0;
+		sdSeeks = 0;
+		for (int b = 0; b < 3000; b++) {
+			for (int k = 100 + rand() % 20; k > 0; k--) {
+				reader.poll();
+				p.prefetch();
+			}
+			p.update();
+			if (b % 100 == 99) p.skipTo((b * 12377) % 300000);
+		}
+		out[pass] = captured[0];
+		calls[pass] = sdOps;
+		seeks[pass] = sdSeeks;
+		expect(p.underruns == 0, "%s the reader, %d underruns", pass ? "with" : "without", p.underruns);
+	}
+	printf("player at 1.23x: card calls through the SD library %d without the reader, %d with. Seeks %d, %d.\n",
+		calls[0], calls[1], seeks[0], seeks[1]);
+	expect(out[0] == out[1], "the same audio with and without the reader");
+	return result();
+}
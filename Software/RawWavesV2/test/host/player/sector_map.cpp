@@ -0,0 +1,66 @@
+// Reading mapped files by sector (user-019). A player at 1.23x, skipping every
+// 100 blocks, plays each file once with firstSector set and once without. The
+// audio has to match, and the mapped file can't use the SD library at all. The
+// files are 16 and 24 bit stereo, and 16 bit stereo after a 45 byte header,
+// whose frames never line up with the sectors.
+#include "SDPlayPCM.h"
+#include "card_device.h"
+
+CardDevice card;
+SDReader reader;
+SDPlayPCM p;
+
+int main() {
+	struct { const char* name; int bits; uint32_t dataOffset; } files[] = {
+		{"s16", 16, 44}, {"s24", 24, 44}, {"odd", 16, 45},
+	};
+	srand(5);
+	// Each file twice, under another name for the mapped one, as a player stays on
+	// a file it knows
+	for (auto& f : files) {
+		std::vector<uint8_t> data(300044);
+		for (uint8_t& b : data) b = rand();
+		addFile(f.name, data);
+		addFile((std::string(f.name) + "m").c_str(), data);
+		card.place((std::string(f.name) + "m").c_str());
+	}
+	reader.begin(&card);
+	for (auto& f : files) {
+		std::string mappedName = std::string(f.name) + "m";
+		std::vector<int16_t> out[2];
+		int calls[2], seeks[2];
+		for (int mapped = 0; mapped < 2; mapped++) {
+			AudioFileInfo info = fileInfo(mapped ? mappedName.c_str() : f.name, 2, f.bits);
+			info.dataOffset = f.dataOffset;
+			info.size = (300044 - f.dataOffset) / info.getBytesPerFrame() * info.getBytesPerFrame();
+			info.firstSector = mapped ? card.firstSectors[mappedName] : 0;
+			srand(9);
+			p.setReader(&reader);
+			p.playbackSpeed = 1.23;
+			p.setInterpolation(INTERPOLATION_LINEAR);
+			p.loopPlayback(true);
+			p.underruns = 0;
+			p.stop();
+			captured[0].clear();
+			p.playFrom(&info);
+			sdOps = 0;
+			sdSeeks = 0;
+			for (int b = 0; b < 3000; b++) {
+				for (int k = 100 + rand() % 20; k > 0; k--) {
+					reader.poll();
+					p.prefetch();
+				}
+				p.update();
+				if (b % 100 == 99) p.skipTo((b * 12377) % info.size);
+			}
+			out[mapped] = captured[0];
+			calls[mapped] = sdOps;
+			seeks[mapped] = sdSeeks;
+			expect(p.underruns == 0, "%s, %s, %d underruns", f.name, mapped ? "mapped" : "not mapped", p.underruns);
+		}
+		printf("%-4s SD library calls %4d not mapped, %d mapped. Seeks %d, %d.\n", f.name, calls[0], calls[1], seeks[0], seeks[1]);
+		expect(out[0] == out[1], "%s, the same audio mapped and not", f.name);
+		expect(calls[1] == 0, "%s, no SD library calls when mapped", f.name);
+	}
+	return result();
+}
@@ -0,0 +1,140 @@
+// Stereo files in each stereo mode (user-006). Left is a rising ramp and right a
+// falling one, so every output sample has a known value at any speed.
+// Also checks the halving add used to mix to mono on the M7 against the one
+// hosts use, on edge values and 20M random pairs.
+#include "SDPlayPCM.h"
+#include "host.h"
+#include <random>
+
+#define FRAMES 20000
+
+// Players stay on the list of every player for good, so there's only the one
+SDPlayPCM p;
+
+static std::vector<uint8_t> ramps(int bytesPerSample) {
+	std::vector<uint8_t> data;
+	for (int i = 0; i < FRAMES; i++) {
+		for (int c = 0; c < 2; c++) {
+			int16_t v = c ? -(int16_t) (i + 5000) : (int16_t) i;
+			if (bytesPerSample == 3) data.push_back(0x55);
+			data.push_back(v & 255);
+			data.push_back((v >> 8) & 255);
+		}
+	}
+	return data;
+}
+
+static void play(AudioFileInfo& info) {
+	captured[0].clear();
+	captured[1].clear();
+	p.playFrom(&info);
+	p.prefetch();
+	for (int blocks = 0; p.isPlaying() && blocks < 2000; blocks++) {
+		p.update();
+		p.prefetch();
+	}
+}
+
+static void checkModes() {
+	for (int bytes : {2, 3}) {
+		addFile("s", ramps(bytes));
+		AudioFileInfo info = fileInfo("s", 2, bytes * 8);
+		for (int mode : {STEREO_MODE_STEREO, STEREO_MODE_LEFT, STEREO_MODE_MONO}) {
+			for (int interpolation = INTERPOLATION_NONE; interpolation <= INTERPOLATION_SINC; interpolation++) {
+				for (float speed : {1.0f, 1.37f, 0.71f}) {
+					p.loopPlayback(false);
+					p.setInterpolation(interpolation);
+					p.setStereoMode(mode);
+					p.playbackSpeed = speed;
+					p.underruns = 0;
+					play(info);
+					// Away from the ends, where the filters reach past the file
+					double margin = 8 * max(1.0f, speed) + 2, error[2] = {0, 0};
+					for (size_t i = margin / speed; i < captured[0].size() && i * speed < FRAMES - margin; i++) {
+						double x = i * speed, left = x, right = -(x + 5000), want[2];
+						if (mode == STEREO_MODE_STEREO) {
+							want[0] = left;
+							want[1] = right;
+						} else if (mode == STEREO_MODE_LEFT) {
+							want[0] = want[1] = left;
+						} else {
+							want[0] = want[1] = (left + right) / 2;
+						}
+						for (int c = 0; c < 2; c++) error[c] = max(error[c], fabs(captured[c][i] - want[c]));
+					}
+					// Exact at unity. Otherwise sample positions are rounded and the sinc ripples a little.
+					double allowed = speed == 1.0f ? 0 : 4;
+					expect(error[0] <= allowed && error[1] <= allowed && p.underruns == 0,
+						"%d bit mode %d interpolation %d speed %.2f: error %.1f %.1f, %d underruns",
+						bytes * 8, mode, interpolation, speed, error[0], error[1], p.underruns);
+				}
+			}
+		}
+	}
+}
+
+static const int16_t edges[] = {-32768, -32767, -2, -1, 0, 1, 2, 32766, 32767};
+#define EDGES (sizeof(edges) / sizeof(edges[0]))
+
+// The mean rounded down, which is what the halving add gives
+static int16_t halvedSum(int16_t a, int16_t b) {
+	long sum = (long) a + b;
+	return sum >= 0 ? sum / 2 : -((-sum + 1) / 2);
+}
+
+// Every pair of edge values through the player's mono mix
+static void checkMixEdges() {
+	std::vector<uint8_t> data;
+	for (size_t frame = 0; frame < 2048; frame++) {
+		for (int c = 0; c < 2; c++) {
+			int16_t v = edges[c ? frame / EDGES % EDGES : frame % EDGES];
+			data.push_back(v & 255);
+			data.push_back((v >> 8) & 255);
+		}
+	}
+	addFile("e", data);
+	AudioFileInfo info = fileInfo("e", 2, 16);
+	p.loopPlayback(false);
+	p.setInterpolation(INTERPOLATION_NONE);
+	p.playbackSpeed = 1.0;
+	p.setStereoMode(STEREO_MODE_MONO);
+	play(info);
+	long wrong = 0;
+	for (size_t frame = 0; frame < 2048 && frame < captured[0].size(); frame++) {
+		int16_t want = halvedSum(edges[frame % EDGES], edges[frame / EDGES % EDGES]);
+		if (captured[0][frame] != want || captured[1][frame] != want) wrong++;
+	}
+	expect(captured[0].size() >= 2048 && wrong == 0, "mono mix of edge values: %ld wrong", wrong);
+}
+
+// What __SHADD16 does, from the ARM architecture manual
+static uint32_t shadd16(uint32_t a, uint32_t b) {
+	int32_t low = ((int16_t) a + (int16_t) b) >> 1;
+	int32_t high = ((int16_t) (a >> 16) + (int16_t) (b >> 16)) >> 1;
+	return (uint16_t) low | (uint32_t) (uint16_t) high << 16;
+}
+
+static void checkHalvingAdd() {
+	long wrong = 0;
+	auto check = [&](int16_t l0, int16_t l1, int16_t r0, int16_t r1) {
+		uint32_t word = shadd16((uint16_t) l0 | (uint32_t) (uint16_t) l1 << 16, (uint16_t) r0 | (uint32_t) (uint16_t) r1 << 16);
+		int16_t l[2] = {l0, l1}, r[2] = {r0, r1};
+		for (int i = 0; i < 2; i++) {
+			int16_t host = (l[i] + r[i]) >> 1;
+			int16_t want = halvedSum(l[i], r[i]);
+			if (host != want || (int16_t) (word >> (16 * i)) != want) wrong++;
+		}
+	};
+	for (auto a : edges) for (auto b : edges) for (auto c : edges) for (auto d : edges) check(a, b, c, d);
+	std::mt19937 rng(1);
+	for (long k = 0; k < 20000000; k++) check(rng(), rng(), rng(), rng());
+	expect(wrong == 0, "halving add: %ld mismatches", wrong);
+	printf("halving add: edge values and 20M random pairs, %ld mismatches\n", wrong);
+}
+
+int main() {
+	checkModes();
+	checkMixEdges();
+	checkHalvingAdd();
+	return result();
+}
@@ -0,0 +1,54 @@
+// Both ends of a stream are padded with silence for interpolation (user-011).
+// A short constant file plays after one that filled the ring with a loud
+// constant. Nothing of the old stream may show at the start, and every frame of
+// the file must play before the tail ramps to silence.
+#include "SDPlayPCM.h"
+#include "host.h"
+
+SDPlayPCM p;
+
+static AudioFileInfo constant(const char* name, int16_t v, int frames) {
+	std::vector<uint8_t> data;
+	for (int i = 0; i < frames; i++) {
+		data.push_back(v & 255);
+		data.push_back((v >> 8) & 255);
+	}
+	addFile(name, data);
+	return fileInfo(name, 1, 16);
+}
+
+int main() {
+	AudioFileInfo loud = constant("loud", 30000, 20000);
+	AudioFileInfo quiet = constant("quiet", 1000, 2000);
+	for (int interpolation = INTERPOLATION_LINEAR; interpolation <= INTERPOLATION_SINC; interpolation++) {
+		for (float speed : {1.0f, 0.5f, 1.5f}) {
+			p.setInterpolation(interpolation);
+			p.loopPlayback(true);
+			p.playbackSpeed = 1;
+			p.playFrom(&loud);
+			for (int b = 0; b < 50; b++) {
+				p.prefetch();
+				p.update();
+			}
+			p.stop();
+			p.loopPlayback(false);
+			p.playbackSpeed = speed;
+			p.playFrom(&quiet);
+			captured[0].clear();
+			for (int b = 0; b < 200; b++) {
+				p.prefetch();
+				p.update();
+			}
+			int stale = 0, last = -1;
+			for (size_t i = 0; i < captured[0].size(); i++) {
+				// The sinc rings a little over 1000 at the edges, but nowhere near 30000
+				if (abs(captured[0][i]) > 1500) stale++;
+				if (captured[0][i] != 0) last = i;
+			}
+			int want = 2000 / speed;
+			expect(stale == 0 && last + 1 >= want - 1 && last + 1 <= want + 2,
+				"interpolation %d speed %.1f: %d samples played for %d frames, %d stale", interpolation, speed, last + 1, want, stale);
+		}
+	}
+	return result();
+}
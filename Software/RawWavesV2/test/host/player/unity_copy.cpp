@@ -0,0 +1,48 @@
+// 16 bit mono at unity speed is copied straight from the ring (user-010). A
+// looping ramp is played at 1.37x, then at 1.0x for 500 blocks, across ring
+// wraps and loop points. Every sample must follow the one before.
+#include "SDPlayPCM.h"
+#include "host.h"
+
+#define FRAMES 3001
+
+SDPlayPCM p;
+
+int main() {
+	std::vector<uint8_t> data;
+	for (int i = 0; i < FRAMES; i++) {
+		data.push_back(i & 255);
+		data.push_back((i >> 8) & 255);
+	}
+	addFile("m", data);
+	AudioFileInfo info = fileInfo("m", 1, 16);
+
+	for (int interpolation = INTERPOLATION_NONE; interpolation <= INTERPOLATION_SINC; interpolation++) {
+		captured[0].clear();
+		p.loopPlayback(true);
+		p.setInterpolation(interpolation);
+		p.playbackSpeed = 1.37;
+		p.underruns = 0;
+		p.playFrom(&info);
+		p.prefetch();
+		for (int b = 0; b < 50; b++) {
+			p.update();
+			p.prefetch();
+		}
+		p.playbackSpeed = 1.0;
+		size_t from = captured[0].size();
+		for (int b = 0; b < 500; b++) {
+			p.update();
+			p.prefetch();
+		}
+		// The first block at 1.0 may still be part way between frames
+		long bad = 0;
+		for (size_t i = from + AUDIO_BLOCK_SAMPLES + 1; i < captured[0].size(); i++) {
+			int16_t was = captured[0][i - 1], now = captured[0][i];
+			if (now != was + 1 && !(now == 0 && was == FRAMES - 1)) bad++;
+		}
+		expect(bad == 0 && p.underruns == 0, "interpolation %d: %ld samples out of sequence, %d underruns",
+			interpolation, bad, p.underruns);
+	}
+	return result();
+}
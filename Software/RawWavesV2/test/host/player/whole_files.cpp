@@ -0,0 +1,84 @@
+// Short files kept whole in RAM (user-015). A whole file is retriggered 50 times
+// at random intervals. No retrigger may touch the card, and each has to play the
+// start of the file on the next block. Banks A, B, C, B then A are chosen, two
+// files each, with room for four. The files of the bank chosen longest ago go.
+#include "SDPlayPCM.h"
+#include "HeadCache.h"
+#include "host.h"
+
+#define BYTES 30000
+
+AudioFileInfo banks[3][2];
+SDPlayPCM p;
+HeadCache cache;
+
+static void makeBank(int bank) {
+	for (int i = 0; i < 2; i++) {
+		std::vector<uint8_t> data(BYTES);
+		for (int k = 0; k < BYTES; k++) data[k] = k * 7 + bank * 2 + i;
+		std::string name = std::string(1, 'A' + bank) + std::to_string(i);
+		addFile(name.c_str(), data);
+		banks[bank][i] = fileInfo(name.c_str(), 1, 16);
+	}
+}
+
+static void chooseBank(int bank) {
+	cache.setBank(banks[bank], 2, false);
+	for (int k = 0; k < 1000; k++) cache.update(0);
+}
+
+// Files of bank that are whole in the cache
+static int whole(int bank) {
+	int count = 0;
+	for (int i = 0; i < 2; i++) count += cache.isResident(&banks[bank][i]);
+	return count;
+}
+
+int main() {
+	for (int bank = 0; bank < 3; bank++) makeBank(bank);
+	cache.residentLimit = 64 * 1024;
+	chooseBank(0);
+	expect(cache.residentCount == 2, "bank A has %d whole files", cache.residentCount);
+
+	AudioFileInfo& info = banks[0][1];
+	const std::vector<uint8_t>& data = simFiles[info.getName()]->data;
+	p.setCache(&cache);
+	p.loopPlayback(true);
+	p.playFrom(&info);
+	p.prefetch();
+	for (int b = 0; b < 20; b++) {
+		p.update();
+		p.prefetch();
+	}
+	sdOps = 0;
+	int late = 0;
+	srand(5);
+	for (int trigger = 0; trigger < 50; trigger++) {
+		captured[0].clear();
+		p.skipTo(0);
+		p.prefetch();
+		p.update();
+		if (captured[0].size() < AUDIO_BLOCK_SAMPLES || memcmp(captured[0].data(), data.data(), AUDIO_BLOCK_SAMPLES * 2) != 0) late++;
+		for (int b = rand() % 30; b > 0; b--) {
+			p.update();
+			p.prefetch();
+		}
+	}
+	printf("50 retriggers: %d card operations, %d didn't start on the next block\n", sdOps, late);
+	expect(sdOps == 0 && late == 0, "retriggers play from RAM on the next block");
+
+	// Which banks' files are whole after each choice
+	const int order[] = {1, 2, 1, 0};
+	const char* kept[] = {"AB", "BC", "BC", "AB"};
+	for (int step = 0; step < 4; step++) {
+		chooseBank(order[step]);
+		char now[4] = {};
+		for (int bank = 0, n = 0; bank < 3; bank++) {
+			if (whole(bank) == 2) now[n++] = 'A' + bank;
+			else expect(whole(bank) == 0, "bank %c is part kept", 'A' + bank);
+		}
+		printf("bank %c chosen: %s whole\n", 'A' + order[step], now);
+		expect(strcmp(now, kept[step]) == 0, "after choosing bank %c, %s whole, not %s", 'A' + order[step], kept[step], now);
+	}
+	return result();
+}
@@ -0,0 +1,159 @@
+#pragma once
+// A directory tree in memory behind a model of SdFat, for the scanner. It counts
+// library calls and the sectors SdFat would load. Its one sector cache is shared
+// by the SD library and SdFat, and directories take 16 entries a sector.
+#include <Arduino.h>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdio>
+
+#define FILE_READ 0
+#define FILE_WRITE 1
+#define O_RDONLY 0
+
+struct Node {
+	std::string name;
+	bool dir = false;
+	std::vector<std::shared_ptr<Node>> kids;
+	std::vector<uint8_t> bytes;
+	uint32_t size = 0;
+	DateTimeFields mtime{};
+	uint32_t id = 0;
+	uint32_t clusters = 1;
+};
+
+struct ScanStats {
+	uint32_t opens = 0, reads = 0, seeks = 0, sectorLoads = 0, entries = 0, writes = 0;
+	uint64_t lastSector = ~0ull;
+	// A sector of a file or directory, unless it's the one already in the cache
+	void load(uint32_t id, uint32_t sector) {
+		uint64_t key = (uint64_t) id << 32 | sector;
+		if (key != lastSector) {
+			sectorLoads++;
+			lastSector = key;
+		}
+	}
+	// 0.35 ms a sector on an SPI card, and a little for each call
+	double ms() { return sectorLoads * 0.35 + opens * 0.02 + reads * 0.002 + entries * 0.003; }
+};
+extern ScanStats stats;
+
+extern std::shared_ptr<Node> rootNode;
+// The node at a path from the root, or NULL
+std::shared_ptr<Node> findPath(const char* path);
+// Added to every file's first sector, to stand for the same files copied to another card
+extern uint32_t sectorShift;
+// SdFat gives a different name for every 50th entry, as if it was out of step with the SD library
+extern bool desync;
+// The FAT, for contiguousRange()
+#define FAT_ID 0xFFFF0000u
+
+class File : public Print {
+public:
+	std::shared_ptr<Node> n;
+	uint64_t p = 0;
+	size_t next = 0;
+	File() {}
+	File(std::shared_ptr<Node> x) : n(x) {}
+	operator bool() const { return (bool) n; }
+	int read() { uint8_t c; return read(&c, 1) == 1 ? c : -1; }
+	int read(void* b, size_t c) {
+		stats.reads++;
+		if (p >= n->size) return 0;
+		if (p + c > n->size) c = n->size - p;
+		for (uint64_t s = p / 512; s <= (p + c - 1) / 512; s++) stats.load(n->id, s);
+		for (size_t i = 0; i < c; i++) ((uint8_t*) b)[i] = p + i < n->bytes.size() ? n->bytes[p + i] : 0;
+		p += c;
+		return c;
+	}
+	bool seek(uint64_t x) { stats.seeks++; p = x; return true; }
+	uint64_t position() { return p; }
+	uint64_t size() { return n->size; }
+	int available() { return n->size - p; }
+	void close() { n.reset(); }
+	const char* name() { return n ? n->name.c_str() : ""; }
+	bool isDirectory() { return n->dir; }
+	File openNextFile(uint8_t m = 0) {
+		if (next >= n->kids.size()) return File();
+		stats.entries++;
+		stats.load(n->id, next / 16);
+		return File(n->kids[next++]);
+	}
+	void rewindDirectory() { next = 0; }
+	size_t write(const void* b, size_t c) {
+		stats.writes++;
+		n->bytes.insert(n->bytes.end(), (uint8_t*) b, (uint8_t*) b + c);
+		n->size = n->bytes.size();
+		return c;
+	}
+	void flush() {}
+	bool getModifyTime(DateTimeFields& t) { t = n->mtime; return true; }
+	bool getCreateTime(DateTimeFields& t) { t = n->mtime; return true; }
+};
+
+class SdSpiCard {
+public:
+	bool readStart(uint32_t) { return true; }
+	bool readStop() { return true; }
+	uint8_t type() const { return 3; }
+};
+
+class FsFile {
+public:
+	std::shared_ptr<Node> n;
+	size_t next = 0;
+	operator bool() const { return (bool) n; }
+	bool isOpen() const { return (bool) n; }
+	bool openNext(FsFile* dir, int = 0) {
+		n.reset();
+		next = 0;
+		if (!dir->n || dir->next >= dir->n->kids.size()) return false;
+		stats.load(dir->n->id, dir->next / 16);
+		n = dir->n->kids[dir->next++];
+		return true;
+	}
+	size_t getName(char* b, size_t length) {
+		if (!n) return 0;
+		snprintf(b, length, "%s", desync && n->id % 50 == 0 ? "x" : n->name.c_str());
+		return strlen(b);
+	}
+	// Every file is in one piece. Finding that out walks its FAT chain, 128 clusters a sector.
+	bool contiguousRange(uint32_t* first, uint32_t* last) {
+		for (uint32_t i = 0; i < (n->clusters + 127) / 128; i++) stats.load(FAT_ID, n->id * 8 + i);
+		*first = firstSector();
+		*last = *first + n->size / 512;
+		return true;
+	}
+	uint32_t firstSector() { return n->id * 1000 + sectorShift; }
+	void close() { n.reset(); }
+};
+
+class SdFs {
+public:
+	SdSpiCard* card() { return 0; }
+	FsFile open(const char* path, int = 0) {
+		FsFile f;
+		f.n = findPath(path);
+		stats.opens++;
+		return f;
+	}
+};
+
+// Files are only ever written, renamed and removed in the root
+class SDClass {
+public:
+	SdFs sdfs;
+	bool begin(int) { return true; }
+	File open(const char* path, uint8_t mode = 0);
+	bool exists(const char* path) { return (bool) findPath(path); }
+	bool rename(const char* from, const char* to) {
+		std::shared_ptr<Node> n = findPath(from);
+		if (!n || findPath(to)) return false;
+		n->name = to;
+		return true;
+	}
+	bool remove(const char* path);
+};
+extern SDClass SD;
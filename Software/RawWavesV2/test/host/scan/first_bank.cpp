@@ -0,0 +1,22 @@
+// How soon the saved bank is ready when the rest of the card is scanned from
+// loop() (user-021), on a model of a 16 x 48 card. Counts up to the end of
+// begin(), cold and with the index, against the whole scan. Both have to find
+// the same files as a blocking scan.
+#include "host.h"
+
+int main() {
+	makeCard(BANKS, 48);
+	Scan blocking = scanCard();
+	removeFile(SCAN_INDEX_FILE);
+	for (int pass = 0; pass < 2; pass++) {
+		Scan scan = scanCard(5);
+		if (!scan.startedWithBank) {
+			printf("This tree scans the whole card before it starts.\n");
+			return result();
+		}
+		printf("%-5s bank 5 ready after ~%5.1f ms, %4u sector loads. Whole card ~%7.1f ms, %4u sector loads.\n",
+			pass ? "warm" : "cold", scan.first.ms(), scan.first.sectorLoads, scan.stats.ms(), scan.stats.sectorLoads);
+		expect(scan.files == blocking.files, "%s, the same files as a blocking scan", pass ? "warm" : "cold");
+	}
+	return result();
+}
@@ -0,0 +1,245 @@
+#include "host.h"
+#include "Settings.h"
+#if __has_include("NamePool.h")
+#include "NamePool.h"
+#endif
+#include <malloc.h>
+
+ScanStats stats;
+std::shared_ptr<Node> rootNode;
+uint32_t sectorShift = 0;
+static size_t heapUsed = 0;
+bool desync = false;
+static uint32_t nextId = 1;
+
+SDClass SD;
+SerialC Serial;
+volatile uint32_t ARM_DWT_CYCCNT;
+
+uint32_t simMillis = 0;
+uint32_t millis() { return 0; }
+uint32_t micros() { return 0; }
+void delay(uint32_t) {}
+
+std::shared_ptr<Node> findPath(const char* path) {
+	std::string p(path);
+	if (p == "/") return rootNode;
+	if (p[0] == '/') p = p.substr(1);
+	std::shared_ptr<Node> n = rootNode;
+	size_t start = 0;
+	while (true) {
+		size_t end = p.find('/', start);
+		std::string part = p.substr(start, end == std::string::npos ? std::string::npos : end - start);
+		std::shared_ptr<Node> found;
+		stats.load(n->id, 0);
+		for (auto& k : n->kids) if (k->name == part) found = k;
+		if (!found) return NULL;
+		n = found;
+		if (end == std::string::npos) return n;
+		start = end + 1;
+	}
+}
+
+File SDClass::open(const char* path, uint8_t mode) {
+	stats.opens++;
+	std::shared_ptr<Node> n = findPath(path);
+	if (!n && mode == FILE_WRITE) {
+		n = std::make_shared<Node>();
+		n->name = path;
+		n->id = nextId++;
+		rootNode->kids.push_back(n);
+	}
+	return n ? File(n) : File();
+}
+
+bool SDClass::remove(const char* path) {
+	removeFile(path);
+	return true;
+}
+
+void removeFile(const char* name) {
+	auto& k = rootNode->kids;
+	for (size_t i = 0; i < k.size(); i++) {
+		if (k[i]->name == name) {
+			k.erase(k.begin() + i);
+			return;
+		}
+	}
+}
+
+static void put32(std::vector<uint8_t>& b, uint32_t v) { for (int i = 0; i < 4; i++) b.push_back(v >> (8 * i)); }
+static void put16(std::vector<uint8_t>& b, uint16_t v) { b.push_back(v); b.push_back(v >> 8); }
+
+std::shared_ptr<Node> wavFile(const std::string& name, int channels, int bits, uint32_t sampleRate, uint32_t frames, bool list) {
+	std::shared_ptr<Node> n = std::make_shared<Node>();
+	n->name = name;
+	n->id = nextId++;
+	std::vector<uint8_t>& b = n->bytes;
+	uint32_t data = frames * channels * bits / 8;
+	b.insert(b.end(), {'R', 'I', 'F', 'F'});
+	put32(b, 36 + data + (list ? 34 : 0));
+	b.insert(b.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+	put32(b, 16);
+	put16(b, 1);
+	put16(b, channels);
+	put32(b, sampleRate);
+	put32(b, sampleRate * channels * bits / 8);
+	put16(b, channels * bits / 8);
+	put16(b, bits);
+	if (list) {
+		b.insert(b.end(), {'L', 'I', 'S', 'T'});
+		put32(b, 26);
+		b.insert(b.end(), 26, 'x');
+	}
+	b.insert(b.end(), {'d', 'a', 't', 'a'});
+	put32(b, data);
+	// Only the header is kept. The audio reads as zeros.
+	n->size = b.size() + data;
+	n->clusters = n->size / 32768 + 1;
+	n->mtime = {10, 20, 12, 3, (uint8_t) (1 + n->id % 28), 5, 124};
+	return n;
+}
+
+void makeCard(int banks, int files) {
+	nextId = 1;
+	rootNode = std::make_shared<Node>();
+	rootNode->dir = true;
+	rootNode->name = "/";
+	int formats[4][3] = {{1, 16, 44100}, {2, 16, 44100}, {2, 24, 48000}, {1, 16, 22050}};
+	for (int d = 0; d < banks; d++) {
+		std::shared_ptr<Node> dir = std::make_shared<Node>();
+		dir->dir = true;
+		dir->name = std::to_string(d);
+		dir->id = nextId++;
+		rootNode->kids.push_back(dir);
+		for (int f = 0; f < files; f++) {
+			int* format = formats[(d + f) % 4];
+			char name[20];
+			snprintf(name, sizeof(name), "s%02d.wav", f);
+			dir->kids.push_back(wavFile(name, format[0], format[1], format[2], 44100 * 2, f % 3 == 0));
+		}
+	}
+}
+
+// What came with later requests. Older trees scan the whole card at once, into
+// fixed tables, and name files with a String.
+template<class S> static auto bankFiles(S* s, int bank, int) -> decltype(s->bankFiles(bank)) { return s->bankFiles(bank); }
+template<class S> static AudioFileInfo* bankFiles(S* s, int bank, long) { return s->fileInfos[bank]; }
+template<class I> static auto nameOf(I& f, int) -> decltype(f.getName()) { return f.getName(); }
+template<class I> static const char* nameOf(I& f, long) { return f.name.c_str(); }
+template<class I> static auto bankOf(I& f, int, int) -> decltype((int) f.bank) { return f.bank; }
+template<class I> static int bankOf(I&, int bank, long) { return bank; }
+template<class T> static auto setTableKB(T& settings, uint16_t kb, int) -> decltype(settings.fileTableKB = kb, void()) { settings.fileTableKB = kb; }
+template<class T> static void setTableKB(T&, uint16_t, long) {}
+template<class S> static auto saveIndex(S* s, int) -> decltype(s->indexPending(), void()) {
+	while (s->indexPending()) s->saveIndex(1000);
+}
+template<class S> static void saveIndex(S*, long) {}
+#ifndef SCAN_SLICE_US
+#define SCAN_SLICE_US 1000
+#endif
+template<class S> static auto begin(S* s, File* root, Settings& settings, int bank, Scan& scan, int) -> decltype(s->begin(root, settings, bank), bool()) {
+	s->begin(root, settings, bank);
+	scan.first = stats;
+	// What setup() gives the engine. It mustn't move.
+	AudioFileInfo* playing = bankFiles(s, bank, 0);
+	while (!s->finished()) s->update(SCAN_SLICE_US);
+	s->finish();
+	expect(bankFiles(s, bank, 0) == playing, "the first bank stays where it is");
+	return true;
+}
+template<class S> static bool begin(S*, File*, Settings&, int, Scan&, long) { return false; }
+template<class S> static auto tableOf(S* s, Scan& scan, int) -> decltype(s->tableBytes(), s->namesFull, void()) {
+	scan.tableBytes = s->tableBytes();
+	scan.capacity = s->fileCapacity;
+	scan.skipped = s->skippedFiles;
+	scan.tableFull = s->tableFull;
+	scan.namesFull = s->namesFull;
+}
+template<class S> static void tableOf(S*, Scan&, long) {}
+
+Scan scanCard(int firstBank, uint16_t fileTableKB) {
+#if __has_include("NamePool.h")
+	fileNames = NamePool();
+#endif
+	stats = ScanStats();
+	// The last scanner's table is left behind, so each scan starts with an empty heap
+	heapUsed = 0;
+	// The sketch's scanner is a global, so it starts out zeroed. Older trees count on that.
+	alignas(FileScanner) static uint8_t storage[sizeof(FileScanner)];
+	memset(storage, 0, sizeof(storage));
+	FileScanner* scanner = new (storage) FileScanner();
+	Settings settings("settings.txt");
+	setTableKB(settings, fileTableKB, 0);
+	File root = SD.open("/");
+	Scan scan;
+	scan.startedWithBank = firstBank >= 0 && begin(scanner, &root, settings, firstBank, scan, 0);
+	if (!scan.startedWithBank) scanner->scan(&root, settings);
+	saveIndex(scanner, 0);
+
+	scan.stats = stats;
+	for (int b = 0; b < BANKS; b++) {
+		for (int i = 0; i < scanner->numFilesInBank[b]; i++) {
+			AudioFileInfo& f = bankFiles(scanner, b, 0)[i];
+			const char* name = nameOf(f, 0);
+			expect(bankOf(f, b, 0) == b && atoi(name) == b, "%s is in bank %d", name, b);
+			char line[200];
+			snprintf(line, sizeof(line), "%s %u %u %u %u %u", name, f.size, f.sampleRate, f.dataOffset, f.format, f.firstSector);
+			scan.files.push_back(line);
+		}
+	}
+	tableOf(scanner, scan, 0);
+	// What setup() plays first
+	scan.firstFile = nameOf(*bankFiles(scanner, 0, 0), 0);
+	scanner->~FileScanner();
+	return scan;
+}
+
+void show(const char* what, Scan& scan) {
+	printf("%-22s files %4zu  opens %4u  read calls %5u  seeks %4u  sector loads %5u  ~%7.1f ms\n",
+		what, scan.files.size(), scan.stats.opens, scan.stats.reads, scan.stats.seeks, scan.stats.sectorLoads, scan.stats.ms());
+}
+
+// Linked with --wrap for malloc, realloc and free, so the scanner's allocations
+// come here. They're counted against heapLimit.
+size_t failSize = 0;
+bool failAll = false;
+size_t heapLimit = 0;
+extern "C" void* __real_malloc(size_t size);
+extern "C" void* __real_realloc(void* p, size_t size);
+extern "C" void __real_free(void* p);
+static bool heapFull(size_t more) {
+	return heapLimit > 0 && heapUsed + more > heapLimit;
+}
+extern "C" void* __wrap_malloc(size_t size) {
+	if (failAll || size == failSize || heapFull(size)) return NULL;
+	void* p = __real_malloc(size);
+	if (p != NULL) heapUsed += malloc_usable_size(p);
+	return p;
+}
+extern "C" void* __wrap_realloc(void* p, size_t size) {
+	size_t was = p != NULL ? malloc_usable_size(p) : 0;
+	if (size > was && heapFull(size - was)) return NULL;
+	void* q = __real_realloc(p, size);
+	if (q != NULL) heapUsed += malloc_usable_size(q) - was;
+	return q;
+}
+extern "C" void __wrap_free(void* p) {
+	if (p != NULL) heapUsed -= malloc_usable_size(p);
+	__real_free(p);
+}
+
+int failures = 0;
+
+bool expect(bool ok, const char* format, ...) {
+	if (!ok) {
+		failures++;
+		printf("FAIL: ");
+		va_list args;
+		va_start(args, format);
+		vprintf(format, args);
+		va_end(args);
+		printf("\n");
+	}
+	return ok;
+}
@@ -0,0 +1,54 @@
+#pragma once
+// What the scan harnesses share: a card of WAV files in banks, a scan of it
+// with the scanner and a count of failed checks.
+#include <SD.h>
+#include <cstdarg>
+#include "FileScanner.h"
+
+// A WAV file of frames frames. list puts a LIST chunk before the data.
+std::shared_ptr<Node> wavFile(const std::string& name, int channels, int bits, uint32_t sampleRate, uint32_t frames, bool list);
+
+// A new card with directories 0 to banks - 1, each with files two second files.
+// They take turns at 44k mono, 44k stereo, 48k 24 bit stereo and 22k mono, and
+// every third one has a LIST chunk.
+void makeCard(int banks, int files);
+
+// Removes a file from the root, like the index
+void removeFile(const char* name);
+
+// What a scan did, and a line for each file it found in bank order
+struct Scan {
+	ScanStats stats;
+	// Up to when the first bank was ready, for a scan that started with one.
+	// Trees from before user-021 can't, and scan the whole card.
+	bool startedWithBank = false;
+	ScanStats first;
+	std::vector<std::string> files;
+	// The table after the scan, and what was left out and why
+	// Left at 0 by trees from before these were counted.
+	uint32_t tableBytes = 0, capacity = 0, skipped = 0, tableFull = 0, namesFull = 0;
+	std::string firstFile;
+};
+
+// Scans the card with a new scanner. With a firstBank, that bank is scanned
+// first and the rest in slices, as setup() and loop() do.
+Scan scanCard(int firstBank = -1, uint16_t fileTableKB = 24);
+
+// The size of allocation that fails, or every one, to see how the scanner copes
+extern size_t failSize;
+extern bool failAll;
+// Bytes the scanner can have allocated at once, like the heap in RAM2. 0 for no limit.
+extern size_t heapLimit;
+
+// Prints what a scan did
+void show(const char* what, Scan& scan);
+
+// Prints a failure and counts it when ok is false
+extern int failures;
+bool expect(bool ok, const char* format, ...);
+
+// Exit status for main()
+inline int result() {
+	if (failures) printf("%d failed\n", failures);
+	return failures ? 1 : 0;
+}
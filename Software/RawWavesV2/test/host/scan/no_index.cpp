@@ -0,0 +1,28 @@
+// A scan with no memory for the new index (user-021). The scan has to end, and
+// find the same files as one with an index, whether it's blocking or starts with
+// a bank. Nothing is written to the card.
+#include "host.h"
+
+// The size of the index the scanner asks for
+struct HostTest {
+	static size_t indexBytes(FileScanner& scanner) { return scanner.indexCapacity() * sizeof(FileScanner::IndexEntry); }
+};
+
+int main() {
+	makeCard(BANKS, 48);
+	Scan normal = scanCard();
+	FileScanner scanner;
+	Settings settings("settings.txt");
+	scanner.fileCapacity = settings.fileTableKB * 1024 / sizeof(AudioFileInfo);
+	failSize = HostTest::indexBytes(scanner);
+
+	for (int firstBank = -1; firstBank < BANKS; firstBank += 6) {
+		removeFile(SCAN_INDEX_FILE);
+		Scan scan = scanCard(firstBank);
+		expect(scan.files == normal.files, "first bank %d, the same files as with an index", firstBank);
+		expect(!findPath(SCAN_INDEX_FILE) && !findPath(SCAN_INDEX_TEMP), "first bank %d, no index written", firstBank);
+	}
+	failSize = 0;
+	printf("%zu files, with and without an index\n", normal.files.size());
+	return result();
+}
@@ -0,0 +1,76 @@
+// Booting with the scan index (user-020), on a model of a 16 x 48 card. Counts
+// library calls and sector loads, and models the time at 0.35 ms a sector. Every
+// scan with an index has to find the same files as a cold scan of the same card.
+#include "host.h"
+#if __has_include("NamePool.h")
+#include "NamePool.h"
+#endif
+
+static Scan coldScan() {
+	removeFile(SCAN_INDEX_FILE);
+	return scanCard();
+}
+
+static uint32_t indexBytes() {
+	std::shared_ptr<Node> n = findPath(SCAN_INDEX_FILE);
+	return n ? n->size : 0;
+}
+
+int main() {
+	makeCard(BANKS, 48);
+	Scan cold = scanCard();
+	show("cold, no index", cold);
+#if __has_include("NamePool.h")
+	// Each path once, with its terminator, after the empty name at 0
+	uint32_t pathBytes = 1;
+	for (int b = 0; b < BANKS; b++) pathBytes += 48 * (std::to_string(b).size() + strlen("/s00.wav") + 1);
+	printf("names %u of %u pool bytes\n", fileNames.used, NAME_POOL_SIZE);
+	expect(fileNames.used == pathBytes, "the pool holds each path once");
+#endif
+	Scan warm = scanCard();
+	show("warm", warm);
+	Scan again = scanCard();
+	show("warm again", again);
+	expect(warm.files == cold.files && again.files == cold.files, "warm scans find what the cold one did");
+	printf("index %u bytes for %zu files\n", indexBytes(), cold.files.size());
+
+	// Touch a file in every fourth bank, add one and remove one
+	for (int d = 0; d < BANKS; d += 4) rootNode->kids[d]->kids[5]->mtime.sec++;
+	rootNode->kids[1]->kids.insert(rootNode->kids[1]->kids.begin() + 10, wavFile("new.wav", 1, 16, 44100, 1000, false));
+	rootNode->kids[2]->kids.erase(rootNode->kids[2]->kids.begin() + 3);
+	Scan changed = scanCard();
+	show("4 touched, 1 added", changed);
+	Scan after = scanCard();
+	show("warm after that", after);
+	Scan fresh = coldScan();
+	expect(changed.files == fresh.files && after.files == fresh.files, "after the changes, the same files as a cold scan");
+
+	// SdFat's listing out of step with the SD library's
+	desync = true;
+	Scan outOfStep = coldScan();
+	desync = false;
+	show("out of step, no index", outOfStep);
+	expect(outOfStep.files == fresh.files, "out of step, the same files");
+	scanCard();
+
+	// The same files somewhere else on the card, like a copy of it. Every first sector has to be found again.
+	sectorShift = 7;
+	Scan moved = scanCard();
+	show("card copied", moved);
+	Scan movedAgain = scanCard();
+	show("warm after the copy", movedAgain);
+	fresh = coldScan();
+	expect(moved.files == fresh.files && movedAgain.files == fresh.files, "after the copy, the same files as a cold scan");
+
+#ifdef SCAN_INDEX_TEMP
+	// The power went between removing the old index and renaming the new one
+	findPath(SCAN_INDEX_FILE)->name = SCAN_INDEX_TEMP;
+	Scan cut = scanCard();
+	show("index left as .tmp", cut);
+	expect(cut.files == fresh.files, "with the .tmp index, the same files");
+	expect(findPath(SCAN_INDEX_FILE) && !findPath(SCAN_INDEX_TEMP), "the .tmp index is renamed");
+	expect(cut.stats.sectorLoads < cold.stats.sectorLoads / 10, "the .tmp index is used");
+#endif
+
+	return result();
+}
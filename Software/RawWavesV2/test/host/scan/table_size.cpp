@@ -0,0 +1,68 @@
+// Sizing the file table from the card (user-023), on models of cards with more
+// and fewer files than fit. Checks how many files each keeps and leaves out,
+// and why. Every file has to be in its directory's bank.
+#include "host.h"
+
+static Scan scanTable(const char* what, int banks, int files, uint16_t kb) {
+	makeCard(banks, files);
+	Scan scan = scanCard(-1, kb);
+	printf("%-28s %5zu files, table %5u bytes, %4u skipped (table full %u, names full %u)\n",
+		what, scan.files.size(), scan.tableBytes, scan.skipped, scan.tableFull, scan.namesFull);
+	return scan;
+}
+
+int main() {
+	Scan s = scanTable("16 x 48, 24 KB", 16, 48, 24);
+	expect(s.files.size() == 768 && s.tableBytes == 768 * sizeof(AudioFileInfo) && s.skipped == 0, "16 x 48 all fit, in a table cut down to them");
+
+	s = scanTable("16 x 48, 4 KB", 16, 48, 4);
+	expect(s.files.size() == s.capacity && s.skipped == 768 - s.capacity && s.tableFull == s.skipped && s.namesFull == 0,
+		"4 KB is full and says so");
+
+	s = scanTable("16 x 80, 24 KB", 16, 80, 24);
+	expect(s.files.size() == 1024 && s.skipped == 256 && s.tableFull == 256, "16 x 80 in 24 KB keeps 1024");
+
+	s = scanTable("16 x 80, 40 KB", 16, 80, 40);
+	expect(s.files.size() == 1280 && s.skipped == 0, "16 x 80 in 40 KB keeps them all");
+
+	s = scanTable("16 x 200, 80 KB", 16, 200, 80);
+	expect(s.skipped > 0 && s.namesFull == s.skipped && s.tableFull == 0, "16 x 200 fills the name pool first");
+
+	// The first bank first and the rest in slices, as setup() and loop() do
+	makeCard(3, 5);
+	s = scanCard(1, 24);
+	printf("%-28s %5zu files, table %5u bytes\n", "3 x 5 from bank 1, 24 KB", s.files.size(), s.tableBytes);
+	expect(s.files.size() == 15 && s.tableBytes == 15 * sizeof(AudioFileInfo), "3 x 5 from bank 1, tables cut down to them");
+	makeCard(16, 48);
+	s = scanCard(5, 24);
+	printf("%-28s %5zu files, table %5u bytes\n", "16 x 48 from bank 5, 24 KB", s.files.size(), s.tableBytes);
+	expect(s.files.size() == 768 && s.tableBytes == 768 * sizeof(AudioFileInfo), "16 x 48 from bank 5, tables cut down to them");
+
+	// With a table that fills up
+	makeCard(16, 80);
+	Scan blocking = scanCard(-1, 24);
+	removeFile(SCAN_INDEX_FILE);
+	Scan background = scanCard(5, 24);
+	expect(background.files == blocking.files, "16 x 80 from bank 5, the same files as a blocking scan");
+	expect(background.tableBytes <= 24 * 1024, "16 x 80 from bank 5 stays within 24 KB");
+
+	// A heap of 112K, what RAM2 leaves beside the caches. With 80 KB asked for, the
+	// table is made smaller so both scan indexes fit, and the next boot uses the index.
+	heapLimit = 112 * 1024;
+	makeCard(16, 48);
+	s = scanCard(-1, 80);
+	Scan warm = scanCard(-1, 80);
+	heapLimit = 0;
+	printf("%-28s %5zu files, warm scan %u sector loads of %u\n", "16 x 48, 80 KB, 112K heap",
+		s.files.size(), warm.stats.sectorLoads, s.stats.sectorLoads);
+	expect(s.files.size() == 768 && warm.files == s.files, "a small heap still keeps 16 x 48");
+	expect(warm.stats.sectorLoads < s.stats.sectorLoads / 10, "a small heap still has room for the index");
+
+	// No memory for the table at all. Every bank is empty and bankFiles() still gives an entry.
+	failAll = true;
+	s = scanTable("no memory", 16, 48, 24);
+	failAll = false;
+	expect(s.files.empty() && s.capacity == 0 && s.firstFile == "", "no memory, no files");
+
+	return result();
+}
@@ -0,0 +1,137 @@
+// Sorting a bank table of 768 shuffled files (user-024): the qsort over the
+// records from before, against keys with an index and one permutation, in name
+// and natural order. Host times, and the name compares each needs. Also checks
+// that the keys never disagree with the full compare and that the order is the
+// same as before.
+#include <cstdio>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+// For its statics
+#include "FileScanner.cpp"
+
+SDClass SD;
+SerialC Serial;
+volatile uint32_t ARM_DWT_CYCCNT;
+uint32_t simMillis = 0;
+uint32_t millis() { return 0; }
+uint32_t micros() { return 0; }
+void delay(uint32_t) {}
+
+static long nameCompares = 0;
+static int failures = 0;
+
+// The compare from before, counted
+static int oldCompare(const void* a, const void* b) {
+	AudioFileInfo* sa = (AudioFileInfo*) a;
+	AudioFileInfo* sb = (AudioFileInfo*) b;
+	if (sa->bank != sb->bank) return sa->bank - sb->bank;
+	nameCompares++;
+	return strcmp(sa->getName(), sb->getName());
+}
+
+static long ties;
+
+// The scanner's table and its sort
+struct HostTest {
+	static AudioFileInfo*& files(FileScanner* fs) { return fs->files; }
+	static void sort(FileScanner* fs) { fs->sortFiles(0); }
+	static uint32_t key(FileScanner* fs, AudioFileInfo& info) { return fs->sortKey(info); }
+};
+
+static int countingEntryCompare(const void* a, const void* b) {
+	if (((FileScanner::SortEntry*) a)->key == ((FileScanner::SortEntry*) b)->key) ties++;
+	return sortEntryCompare(a, b);
+}
+
+int main() {
+	std::mt19937 rng(7);
+	const char* stems[] = {"Take ", "kick_", "", "Field Rec ", "pad-", "Loop", "vox ", "Drone"};
+	std::vector<AudioFileInfo> table;
+	for (int b = 0; b < 16; b++) {
+		for (int f = 0; f < 48; f++) {
+			char name[64];
+			int n = rng() % 120;
+			snprintf(name, sizeof(name), "%s%d%s.wav", stems[rng() % 8], n, rng() % 3 == 0 ? " b" : "");
+			fileNames.start(std::to_string(b).c_str(), name);
+			AudioFileInfo info;
+			info.nameOffset = fileNames.keep();
+			info.bank = b;
+			info.size = f;
+			table.push_back(info);
+		}
+	}
+	std::shuffle(table.begin(), table.end(), rng);
+	FileScanner* fs = new FileScanner();
+	AudioFileInfo* files = (AudioFileInfo*) malloc(table.size() * sizeof(AudioFileInfo));
+	HostTest::files(fs) = files;
+	fs->fileCount = table.size();
+
+	const int runs = 2000;
+	auto time = [&](auto sort) {
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < runs; r++) {
+			memcpy(files, table.data(), table.size() * sizeof(AudioFileInfo));
+			sort();
+		}
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / runs;
+	};
+	auto order = [&]() {
+		std::vector<std::string> names;
+		for (uint16_t i = 0; i < fs->fileCount; i++) names.push_back(files[i].getName());
+		return names;
+	};
+	double copy = time([] {});
+
+	nameCompares = 0;
+	double old = time([&] { qsort(files, fs->fileCount, sizeof(AudioFileInfo), oldCompare); }) - copy;
+	long oldCompares = nameCompares / runs;
+	std::vector<std::string> oldOrder = order();
+	printf("768 files, 16 banks, shuffled. Host times, per sort.\n");
+	printf("old: qsort over the records          %7.1f us  %5ld name compares\n", old, oldCompares);
+
+	for (uint8_t mode : {SORT_NAME, SORT_NATURAL}) {
+		sortMode = mode;
+		double t = time([&] { HostTest::sort(fs); }) - copy;
+		std::vector<std::string> newOrder = order();
+
+		// Name compares are only needed where the keys tie
+		std::vector<FileScanner::SortEntry> keys(table.size());
+		memcpy(files, table.data(), table.size() * sizeof(AudioFileInfo));
+		for (uint16_t i = 0; i < keys.size(); i++) {
+			keys[i].key = HostTest::key(fs, files[i]);
+			keys[i].index = i;
+		}
+		sortTable = files;
+		ties = 0;
+		qsort(keys.data(), keys.size(), sizeof(FileScanner::SortEntry), countingEntryCompare);
+
+		// Where the keys differ, they must agree with the full compare
+		long disagree = 0;
+		for (int n = 0; n < 200000; n++) {
+			int a = rng() % keys.size(), b = rng() % keys.size();
+			uint32_t ka = HostTest::key(fs, table[a]), kb = HostTest::key(fs, table[b]);
+			if (ka != kb && (ka < kb) != (fileCompare(&table[a], &table[b]) < 0)) disagree++;
+		}
+		long outOfOrder = 0;
+		memcpy(files, table.data(), table.size() * sizeof(AudioFileInfo));
+		HostTest::sort(fs);
+		for (size_t i = 1; i < table.size(); i++) {
+			if (fileCompare(&files[i - 1], &files[i]) > 0) outOfOrder++;
+		}
+		printf("%-8s keys + one permutation     %7.1f us  %5ld name compares\n", mode == SORT_NAME ? "name:" : "natural:", t, ties);
+		printf("  in 200000 random pairs the keys disagreed %ld times, %ld pairs out of order%s\n", disagree, outOfOrder,
+			mode == SORT_NAME ? newOrder == oldOrder ? ", same order as old" : ", NOT the same order as old" : "");
+		if (mode == SORT_NATURAL) {
+			printf("  bank 3 starts");
+			int shown = 0;
+			for (auto& n : newOrder) {
+				if (n.rfind("3/", 0) == 0 && shown++ < 8) printf(" \"%s\"", n.c_str() + 2);
+			}
+			printf("\n");
+		}
+		if (disagree || outOfOrder || (mode == SORT_NAME && newOrder != oldOrder)) failures++;
+	}
+	return failures ? 1 : 0;
+}
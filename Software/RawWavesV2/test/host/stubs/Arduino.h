@@ -0,0 +1,134 @@
+#pragma once
+// Just enough of the Teensy core to build the sketch's classes on a PC
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+
+typedef bool boolean;
+typedef uint8_t byte;
+typedef struct {
+	uint8_t sec;
+	uint8_t min;
+	uint8_t hour;
+	uint8_t wday;
+	uint8_t mday;
+	uint8_t mon;
+	uint8_t year;
+} DateTimeFields;
+
+#define B00000001 1
+#define B00000110 6
+#define B00111000 56
+#define B01000000 64
+#define HEX 16
+#define DEC 10
+#define INPUT 0
+#define INPUT_PULLUP 2
+#define OUTPUT 1
+#define LOW 0
+#define HIGH 1
+#define RISING 3
+#define A0 14
+#define A1 15
+#define A5 19
+#define A8 22
+#define SS 10
+#define PI 3.1415926535897932384626433832795
+#define constrain(a,l,h) ((a)<(l)?(l):((a)>(h)?(h):(a)))
+#define DMAMEM
+#define FASTRUN
+#define EXTMEM
+#define F_CPU_ACTUAL 600000000
+
+extern volatile uint32_t ARM_DWT_CYCCNT;
+inline void __disable_irq() {}
+inline void __enable_irq() {}
+
+// Like Arduino's, the text is on the heap and the String itself is only a
+// pointer to it. Code from before user-022 moved Strings byte by byte in qsort.
+class String {
+	std::string* s;
+public:
+	String() : s(new std::string()) {}
+	String(const char* c) : s(new std::string(c ? c : "")) {}
+	String(const std::string& x) : s(new std::string(x)) {}
+	String(int i) : s(new std::string(std::to_string(i))) {}
+	String(const String& o) : s(new std::string(*o.s)) {}
+	~String() { delete s; }
+	String& operator=(const String& o) { *s = *o.s; return *this; }
+	String operator+(const String& o) const { return String(*s + *o.s); }
+	String operator+(const char* o) const { return String(*s + o); }
+	String operator+(char c) const { return String(*s + c); }
+	friend String operator+(const char* a, const String& b) { return String(a + *b.s); }
+	String& operator+=(const String& o) { *s += *o.s; return *this; }
+	String& operator+=(char c) { *s += c; return *this; }
+	String& operator+=(const char* c) { *s += c; return *this; }
+	bool operator==(const String& o) const { return *s == *o.s; }
+	bool operator==(const char* o) const { return *s == o; }
+	char operator[](unsigned i) const { return (*s)[i]; }
+	const char* c_str() const { return s->c_str(); }
+	unsigned length() const { return s->size(); }
+	int compareTo(const String& o) const { return s->compare(*o.s); }
+	long toInt() const { return atol(s->c_str()); }
+	float toFloat() const { return atof(s->c_str()); }
+	bool startsWith(const String& p) const { return s->rfind(*p.s, 0) == 0; }
+	bool endsWith(const String& p) const { return s->size() >= p.s->size() && s->compare(s->size() - p.s->size(), p.s->size(), *p.s) == 0; }
+	int indexOf(char c) const { auto p = s->find(c); return p == std::string::npos ? -1 : (int) p; }
+	int lastIndexOf(char c) const { auto p = s->rfind(c); return p == std::string::npos ? -1 : (int) p; }
+	String substring(unsigned a) const { return String(s->substr(a)); }
+	String substring(unsigned a, unsigned b) const { return String(s->substr(a, b - a)); }
+	String& toLowerCase() { for (auto& c : *s) c = tolower(c); return *this; }
+	void toCharArray(char* b, unsigned n) const { strncpy(b, s->c_str(), n); }
+	void reserve(unsigned) {}
+};
+
+// Output is thrown away
+class Print {
+public:
+	template<class T> size_t print(T) { return 0; }
+	template<class T> size_t print(T, int) { return 0; }
+	template<class T> size_t println(T) { return 0; }
+	template<class T> size_t println(T, int) { return 0; }
+	size_t println() { return 0; }
+	size_t write(uint8_t) { return 0; }
+	size_t write(const uint8_t*, size_t) { return 0; }
+};
+
+class SerialC : public Print {
+public:
+	operator bool() { return true; }
+};
+extern SerialC Serial;
+
+// Time only moves when a harness moves it
+extern uint32_t simMillis;
+class elapsedMillis {
+	uint32_t ms;
+public:
+	elapsedMillis(uint32_t v = 0) : ms(simMillis - v) {}
+	operator uint32_t() const { return simMillis - ms; }
+	elapsedMillis& operator=(uint32_t v) { ms = simMillis - v; return *this; }
+};
+class elapsedMicros {
+	uint32_t us;
+public:
+	elapsedMicros(uint32_t v = 0) : us(v) {}
+	operator uint32_t() const { return us; }
+	elapsedMicros& operator=(uint32_t v) { us = v; return *this; }
+};
+
+void delay(uint32_t);
+uint32_t millis();
+uint32_t micros();
+int analogRead(int);
+void analogReadRes(int);
+void pinMode(int, int);
+void digitalWrite(int, int);
+int digitalRead(int);
+void attachInterrupt(int, void (*)(), int);
+
+using std::min;
+using std::max;
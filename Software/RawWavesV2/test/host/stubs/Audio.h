@@ -0,0 +1,39 @@
+#pragma once
+#include <AudioStream.h>
+
+class AudioEffectFade : public AudioStream {
+public:
+	AudioEffectFade() : AudioStream(1, 0) {}
+	void update() {}
+	void fadeIn(uint32_t) {}
+	void fadeOut(uint32_t) {}
+};
+
+class AudioMixer4 : public AudioStream {
+public:
+	AudioMixer4() : AudioStream(4, 0) {}
+	void update() {}
+	void gain(unsigned, float) {}
+};
+
+class AudioAnalyzePeak : public AudioStream {
+public:
+	AudioAnalyzePeak() : AudioStream(1, 0) {}
+	void update() {}
+	bool available() { return true; }
+	float read() { return 0; }
+};
+
+class AudioOutputPT8211 : public AudioStream {
+public:
+	AudioOutputPT8211() : AudioStream(2, 0) {}
+	void update() {}
+};
+
+class AudioConnection {
+public:
+	AudioConnection() {}
+	AudioConnection(AudioStream&, AudioStream&) {}
+	AudioConnection(AudioStream&, unsigned char, AudioStream&, unsigned char) {}
+	int connect(AudioStream&, unsigned char, AudioStream&, unsigned char) { return 0; }
+};
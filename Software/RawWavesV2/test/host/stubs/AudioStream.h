@@ -0,0 +1,34 @@
+#pragma once
+// The harness decides what allocate() and transmit() do
+#include <Arduino.h>
+
+#define AUDIO_BLOCK_SAMPLES 128
+#define AUDIO_SAMPLE_RATE_EXACT 44117.64706f
+
+typedef struct audio_block_struct {
+	uint8_t ref_count;
+	uint8_t reserved1;
+	uint16_t memory_pool_index;
+	int16_t data[AUDIO_BLOCK_SAMPLES];
+} audio_block_t;
+
+class AudioStream {
+public:
+	AudioStream(unsigned char n, audio_block_t** q) {}
+	virtual void update() = 0;
+	uint16_t processorUsageMax() { return 0; }
+	void processorUsageMaxReset() {}
+protected:
+	static audio_block_t* allocate();
+	void transmit(audio_block_t*, unsigned char index = 0);
+	static void release(audio_block_t*);
+	audio_block_t* receiveReadOnly(unsigned i = 0);
+	audio_block_t* receiveWritable(unsigned i = 0);
+};
+
+#define AudioNoInterrupts()
+#define AudioInterrupts()
+void AudioMemory(int);
+int AudioProcessorUsageMax();
+void AudioProcessorUsageMaxReset();
+int AudioMemoryUsageMax();
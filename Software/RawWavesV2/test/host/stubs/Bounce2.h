@@ -0,0 +1,16 @@
+#pragma once
+#include <Arduino.h>
+
+class Button {
+public:
+	void attach(int, int) {}
+	void interval(int) {}
+	void setPressedState(int) {}
+	bool update() { return false; }
+	bool pressed() { return false; }
+	bool released() { return false; }
+	bool isPressed() { return false; }
+	bool fell() { return false; }
+	bool rose() { return false; }
+	bool read() { return false; }
+};
@@ -0,0 +1,8 @@
+#pragma once
+
+class EEPROMC {
+public:
+	uint8_t read(int) { return 0; }
+	void write(int, uint8_t) {}
+};
+extern EEPROMC EEPROM;
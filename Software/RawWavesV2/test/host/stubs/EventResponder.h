@@ -0,0 +1,14 @@
+#pragma once
+
+class EventResponder;
+typedef EventResponder& EventResponderRef;
+
+class EventResponder {
+	void* context = 0;
+public:
+	typedef void (*F)(EventResponderRef);
+	void attachImmediate(F) {}
+	void attach(F) {}
+	void setContext(void* c) { context = c; }
+	void* getContext() { return context; }
+};
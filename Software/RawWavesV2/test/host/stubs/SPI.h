@@ -0,0 +1,13 @@
+#pragma once
+#include <Arduino.h>
+#include <EventResponder.h>
+
+class SPIC {
+public:
+	void setMOSI(int) {}
+	void setSCK(int) {}
+	uint8_t transfer(uint8_t) { return 0xFF; }
+	bool transfer(const void*, void*, size_t, EventResponderRef) { return true; }
+	void setTransferWriteFill(uint8_t) {}
+};
+extern SPIC SPI;
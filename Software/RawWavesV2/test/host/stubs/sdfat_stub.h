@@ -0,0 +1,25 @@
+#pragma once
+// Just enough of SdFat 2 for the players. The scan model has its own.
+class SdSpiCard {
+public:
+	bool readStart(uint32_t) { return true; }
+	bool readStop() { return true; }
+	uint8_t type() const { return 3; }
+};
+
+class FsFile {
+public:
+	operator bool() const { return true; }
+	bool isOpen() const { return true; }
+	bool openNext(FsFile*, int = 0) { return true; }
+	size_t getName(char*, size_t) { return 0; }
+	bool contiguousRange(uint32_t*, uint32_t*) { return false; }
+	uint32_t firstSector() { return 0; }
+	void close() {}
+};
+
+class SdFs {
+public:
+	SdSpiCard* card() { return 0; }
+	FsFile open(const char*, int = 0) { return FsFile(); }
+};
@@ -0,0 +1,3 @@
+#pragma once
+#define AudioStartUsingSPI()
+#define AudioStopUsingSPI()
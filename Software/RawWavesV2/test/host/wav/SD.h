@@ -0,0 +1,57 @@
+#pragma once
+// Files held in memory for the header fuzz. Counts read calls, seeks and the
+// 512 byte sectors they touch, and gives up on a reader that reads too much.
+#include <Arduino.h>
+#include <sdfat_stub.h>
+#include <memory>
+#include <vector>
+
+#define FILE_READ 0
+#define FILE_WRITE 1
+#define O_RDONLY 0
+
+struct Stats {
+	uint32_t reads = 0, seeks = 0, sectorLoads = 0;
+	uint64_t lastSector = ~0ull;
+	void load(uint32_t id, uint32_t sector) {
+		uint64_t key = (uint64_t) id << 32 | sector;
+		if (key != lastSector) {
+			sectorLoads++;
+			lastSector = key;
+		}
+	}
+};
+extern Stats stats;
+// A read call past this many throws, so a reader stuck in a loop can be counted
+extern uint32_t readLimit;
+
+struct SimFile {
+	std::vector<uint8_t> bytes;
+	uint32_t id;
+};
+
+class File : public Print {
+public:
+	std::shared_ptr<SimFile> f;
+	uint64_t p = 0;
+	File() {}
+	File(std::shared_ptr<SimFile> x) : f(x) {}
+	operator bool() const { return (bool) f; }
+	int read() { uint8_t b; return read(&b, 1) == 1 ? b : -1; }
+	int read(void* d, size_t c) {
+		if (++stats.reads > readLimit) throw 1;
+		if (p >= f->bytes.size()) return 0;
+		if (p + c > f->bytes.size()) c = f->bytes.size() - p;
+		for (uint64_t s = p / 512; s <= (p + c - 1) / 512; s++) stats.load(f->id, s);
+		memcpy(d, &f->bytes[p], c);
+		p += c;
+		return c;
+	}
+	bool seek(uint64_t x) { stats.seeks++; p = x; return true; }
+	uint64_t position() { return p; }
+	uint64_t size() { return f->bytes.size(); }
+	int available() { return f->bytes.size() - p; }
+	void close() { f.reset(); }
+	const char* name() { return ""; }
+	bool isDirectory() { return false; }
+};
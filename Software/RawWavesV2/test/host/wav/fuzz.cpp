@@ -0,0 +1,198 @@
+// Fuzzes the WAV header reader and compares it with the one from before user-025,
+// which read a byte at a time. Fails if the reader under test hangs, accepts data
+// outside the file or a size that ends part way through a frame.
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "WavHeaderReader.h"
+#include "OldWavHeaderReader.h"
+
+Stats stats;
+uint32_t readLimit = ~0u;
+SerialC Serial;
+volatile uint32_t ARM_DWT_CYCCNT;
+uint32_t simMillis = 0;
+uint32_t millis() { return 0; }
+uint32_t micros() { return 0; }
+void delay(uint32_t) {}
+
+static uint32_t nextId = 1;
+
+static void put32(std::vector<uint8_t>& b, uint32_t v) { for (int i = 0; i < 4; i++) b.push_back(v >> (8 * i)); }
+static void put16(std::vector<uint8_t>& b, uint16_t v) { b.push_back(v); b.push_back(v >> 8); }
+
+static void chunk(std::vector<uint8_t>& b, const char* id, const std::vector<uint8_t>& contents) {
+	b.insert(b.end(), id, id + 4);
+	put32(b, contents.size());
+	b.insert(b.end(), contents.begin(), contents.end());
+	if (contents.size() & 1) b.push_back(0);
+}
+
+#define LAYOUTS 7
+static const char* layoutNames[LAYOUTS] = {"plain 44 byte", "LIST 37 before fmt", "extensible", "float",
+	"LIST 3001 before fmt", "bext 602 before fmt", "fact after fmt"};
+
+// A valid file in one of the layouts
+static std::vector<uint8_t> makeWav(std::mt19937& rng, int layout, uint32_t frames = 1000) {
+	int channels = 1 + rng() % 2, bits = 8 * (1 + rng() % 4);
+	uint32_t rate = 44100;
+	bool isFloat = false, extensible = layout == 2;
+	if (layout == 3) {
+		bits = 32;
+		isFloat = true;
+	}
+	std::vector<uint8_t> fmt;
+	put16(fmt, extensible ? 0xFFFE : isFloat ? 3 : 1);
+	put16(fmt, channels);
+	put32(fmt, rate);
+	put32(fmt, rate * channels * bits / 8);
+	put16(fmt, channels * bits / 8);
+	put16(fmt, bits);
+	if (extensible) {
+		put16(fmt, 22);
+		put16(fmt, bits);
+		put32(fmt, 3);
+		put16(fmt, isFloat ? 3 : 1);
+		for (int i = 0; i < 14; i++) fmt.push_back(i);
+	}
+	std::vector<uint8_t> body = {'W', 'A', 'V', 'E'};
+	if (layout == 1 || layout == 4) chunk(body, "LIST", std::vector<uint8_t>(layout == 4 ? 3001 : 37, 'x'));
+	if (layout == 5) chunk(body, "bext", std::vector<uint8_t>(602, 'b'));
+	chunk(body, "fmt ", fmt);
+	if (layout == 6) {
+		std::vector<uint8_t> fact;
+		put32(fact, frames);
+		chunk(body, "fact", fact);
+	}
+	std::vector<uint8_t> data(frames * channels * bits / 8);
+	for (auto& d : data) d = rng();
+	chunk(body, "data", data);
+	std::vector<uint8_t> file = {'R', 'I', 'F', 'F'};
+	put32(file, body.size());
+	file.insert(file.end(), body.begin(), body.end());
+	return file;
+}
+
+struct Result {
+	bool ok;
+	bool hung;
+	uint32_t size, rate, offset;
+	uint8_t format;
+};
+
+template<class Reader> static Result parse(const std::vector<uint8_t>& bytes, uint32_t limit = 200000) {
+	Reader reader;
+	AudioFileInfo info;
+	auto f = std::make_shared<SimFile>();
+	f->bytes = bytes;
+	f->id = nextId++;
+	File file(f);
+	Result r{};
+	readLimit = stats.reads + limit;
+	try {
+		r.ok = reader.read(&file, info);
+	} catch (int) {
+		r.hung = true;
+	}
+	readLimit = ~0u;
+	r.size = info.size;
+	r.rate = info.sampleRate;
+	r.offset = info.dataOffset;
+	r.format = info.format;
+	return r;
+}
+
+int main() {
+	std::mt19937 rng(1);
+
+	// Valid files. The old reader loses its place after an odd sized chunk.
+	long agree = 0, differ = 0, oddChunk = 0;
+	for (int i = 0; i < 2000; i++) {
+		auto b = makeWav(rng, i % LAYOUTS);
+		Result n = parse<WavHeaderReader>(b), o = parse<OldWavHeaderReader>(b);
+		if (n.ok && o.ok && n.size == o.size && n.rate == o.rate && n.offset == o.offset && n.format == o.format) {
+			agree++;
+		} else {
+			differ++;
+			if ((i % LAYOUTS == 1 || i % LAYOUTS == 4) && n.ok) oddChunk++;
+		}
+	}
+	printf("valid files: %ld agree, %ld differ, %ld of those after an odd sized LIST chunk\n", agree, differ, oddChunk);
+
+	// Malformed: truncations, bit flips, mangled sizes, junk
+	long cases = 0, accepted = 0, partFrame = 0, outside = 0, hung = 0, oldHung = 0, mostReads = 0;
+	for (int i = 0; i < 200000; i++) {
+		auto b = makeWav(rng, rng() % LAYOUTS, rng() % 50);
+		switch (rng() % 5) {
+			case 0:
+				b.resize(rng() % (b.size() + 1));
+				break;
+			case 1:
+				for (int k = 1 + rng() % 8; k--;) b[rng() % b.size()] ^= 1 << (rng() % 8);
+				break;
+			case 2: {
+				uint32_t p = rng() % (b.size() - 3);
+				uint32_t v = rng() % 3 == 0 ? 0xFFFFFFFF : rng() % 3 == 0 ? 0 : rng();
+				memcpy(&b[p], &v, 4);
+				break;
+			}
+			case 3: {
+				uint32_t p = 12 + rng() % (b.size() - 12);
+				uint32_t v = rng() % 2 ? 0xFFFFFFF8 : 0x7FFFFFFF;
+				if (p + 4 <= b.size()) memcpy(&b[p], &v, 4);
+				b.resize(rng() % (b.size() + 1));
+				break;
+			}
+			case 4:
+				for (auto& x : b) if (rng() % 16 == 0) x = rng();
+				break;
+		}
+		cases++;
+		uint32_t before = stats.reads;
+		Result n = parse<WavHeaderReader>(b);
+		mostReads = max(mostReads, (long) (stats.reads - before));
+		if (n.hung) hung++;
+		if (n.ok) {
+			accepted++;
+			if (n.offset + n.size > b.size() || n.offset < 12) outside++;
+			AudioFileInfo t;
+			t.format = n.format;
+			if (n.size % t.getBytesPerFrame()) partFrame++;
+		}
+		if (i < 20000 && parse<OldWavHeaderReader>(b, 20000).hung) oldHung++;
+	}
+	printf("malformed: %ld cases, %ld accepted, %ld with data outside the file, %ld ending part way through a frame\n",
+		cases, accepted, outside, partFrame);
+	printf("reader hung on %ld, most read calls %ld\n", hung, mostReads);
+	printf("old reader on the first 20000 of them: %ld ran past 20000 read calls\n", oldHung);
+
+	// Per file cost
+	printf("\nper file:                read calls  seeks  sector loads  host us\n");
+	for (int layout = 0; layout < LAYOUTS; layout++) {
+		std::mt19937 r2(9);
+		auto b = makeWav(r2, layout, 100);
+		for (int old = 0; old < 2; old++) {
+			stats = Stats();
+			const int runs = 20000;
+			auto t0 = std::chrono::steady_clock::now();
+			for (int k = 0; k < runs; k++) {
+				stats.lastSector = ~0ull;
+				Result r = old ? parse<OldWavHeaderReader>(b) : parse<WavHeaderReader>(b);
+				if (r.hung) {
+					stats.reads = 0;
+					break;
+				}
+			}
+			double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count() / runs;
+			if (old && stats.reads == 0) {
+				printf("%-22s old  hung\n", layoutNames[layout]);
+			} else {
+				printf("%-22s %s %5u %6u %8u %10.2f\n", layoutNames[layout], old ? "old" : "new",
+					stats.reads / runs, stats.seeks / runs, stats.sectorLoads / runs, us);
+			}
+		}
+	}
+	return hung || outside || partFrame ? 1 : 0;
+}